@@ -1,858 +1,451 @@
 #include "characters.h"
 
-static const char char_space[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0}
-};
+#include <linux/bitmap.h>
+#include <linux/firmware.h>
+#include <linux/hashtable.h>
+#include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/nls.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
 
-static const char char_0[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 1, 1},
-    {1, 0, 1, 0, 1},
-    {1, 1, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_1[ROWS][COLS] = {
-    {0, 0, 1, 0, 0},
-    {0, 1, 1, 0, 0},
-    {1, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {1, 1, 1, 1, 1}
-};
-static const char char_2[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 0, 0},
-    {1, 1, 1, 1, 1}
-};
-static const char char_3[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0}
-};
-static const char char_4[ROWS][COLS] = {
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 1, 0},
-    {0, 1, 0, 1, 0},
-    {1, 0, 0, 1, 0},
-    {1, 1, 1, 1, 1},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 1, 0}
-};
-static const char char_5[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {1, 0, 0, 0, 0},
-    {1, 1, 1, 1, 0},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0}
-};
-static const char char_6[ROWS][COLS] = {
-    {0, 0, 1, 1, 0},
-    {0, 1, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_7[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0}
-};
-static const char char_8[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_9[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 1, 0},
-    {0, 1, 1, 0, 0}
-};
-static const char char_colon[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 0, 0, 0}
-};
-static const char char_semi_colon[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 0, 0}
-};
-static const char char_less_than[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 0, 0}
-};
-static const char char_equal[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 1, 1, 1, 1},
-    {0, 0, 0, 0, 0},
-    {1, 1, 1, 1, 1},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0}
-};
-static const char char_greater_than[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 0, 0, 0, 0}
-};
-static const char char_question_mark[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 1, 0, 0}
-};
-static const char char_at[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {0, 0, 1, 1, 1},
-    {0, 1, 0, 1, 1},
-    {0, 1, 0, 1, 1},
-    {0, 1, 1, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_A[ROWS][COLS] = {
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_B[ROWS][COLS] = {
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0}
-};
-static const char char_C[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_D[ROWS][COLS] = {
-    {1, 1, 1, 0, 0},
-    {1, 0, 0, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 1, 0},
-    {1, 1, 1, 0, 0}
-};
-static const char char_E[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 1, 1, 1, 1},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 1, 1, 1, 1}
-};
-static const char char_F[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 1, 1, 1, 1},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0}
-};
-static const char char_G[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 0},
-    {1, 0, 1, 1, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_H[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_I[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {1, 1, 1, 1, 1}
-};
-static const char char_J[ROWS][COLS] = {
-    {0, 0, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_K[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 1, 0},
-    {1, 0, 1, 0, 0},
-    {1, 1, 0, 0, 0},
-    {1, 0, 1, 0, 0},
-    {1, 0, 0, 1, 0},
-    {1, 0, 0, 0, 1}
-};
-static const char char_L[ROWS][COLS] = {
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 1}
-};
-static const char char_M[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 1, 0, 1, 1},
-    {1, 0, 1, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_N[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 1, 0, 0, 1},
-    {1, 0, 1, 0, 1},
-    {1, 0, 0, 1, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_O[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_P[ROWS][COLS] = {
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0}
-};
-static const char char_Q[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 1, 0, 1},
-    {1, 0, 0, 1, 1},
-    {0, 1, 1, 0, 1}
-};
-static const char char_R[ROWS][COLS] = {
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0},
-    {1, 0, 1, 0, 0},
-    {1, 0, 0, 1, 0},
-    {1, 0, 0, 0, 1}
-};
-static const char char_S[ROWS][COLS] = {
-    {0, 1, 1, 1, 1},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0}
-};
-static const char char_T[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0}
-};
-static const char char_U[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_V[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 0, 1, 0},
-    {0, 1, 0, 1, 0},
-    {0, 0, 1, 0, 0}
-};
-static const char char_W[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 1, 0, 1},
-    {1, 0, 1, 0, 1},
-    {1, 1, 0, 1, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_X[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_Y[ROWS][COLS] = {
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0}
-};
-static const char char_Z[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 1, 1, 1, 1}
-};
-static const char char_open_bracket[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-};
-static const char char_backslash[ROWS][COLS] = {
-    {1, 0, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 0, 1}
-};
-static const char char_close_bracket[ROWS][COLS] = {
-    {0, 1, 1, 1, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 1, 0},
-    {0, 1, 1, 1, 0},
-};
-static const char char_caret[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 0, 1, 0},
-    {1, 0, 0, 0, 1},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-};
-static const char char_underscore[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 1, 1, 1, 1}
-};
-static const char char_tick[ROWS][COLS] = {
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0}
-};
-static const char char_a[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 1}
-};
-static const char char_b[ROWS][COLS] = {
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0}
-};
-static const char char_c[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_d[ROWS][COLS] = {
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 0, 1},
-    {0, 1, 1, 1, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_e[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 1},
-    {1, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0}
-};
-static const char char_f[ROWS][COLS] = {
-    {0, 0, 1, 1, 0},
-    {0, 1, 0, 0, 1},
-    {0, 1, 0, 0, 0},
-    {1, 1, 1, 1, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0}
+// A font: the glyph of every char value as GLYPH_COLS column bitmasks (bit r
+// lit for row r), indexed directly by the character, and the lit columns of
+// each glyph measured once when the font is added
+struct font {
+  struct list_head node;
+  char name[FONT_NAME_SIZE];
+  u8 glyphs[FONT_GLYPHS][GLYPH_COLS];
+  u8 left[FONT_GLYPHS];  // first lit glyph column
+  u8 cols[FONT_GLYPHS];  // columns from the first to the last lit one
+  DECLARE_BITMAP(mapped, FONT_GLYPHS);  // characters not left as a block
 };
-static const char char_g[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_h[ROWS][COLS] = {
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_i[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0}
-};
-static const char char_j[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 1, 0},
-    {0, 0, 0, 1, 0},
-    {0, 1, 1, 0, 0}
-};
-static const char char_k[ROWS][COLS] = {
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0},
-    {1, 0, 0, 1, 0},
-    {1, 0, 1, 0, 0},
-    {1, 1, 0, 0, 0},
-    {1, 0, 1, 0, 0},
-    {1, 0, 0, 1, 0}
-};
-static const char char_l[ROWS][COLS] = {
-    {1, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {0, 1, 0, 0, 0},
-    {1, 1, 1, 0, 0}
-};
-static const char char_m[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 1, 1, 1, 0},
-    {1, 0, 1, 0, 1},
-    {1, 0, 1, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_n[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 0, 1, 1, 0},
-    {1, 1, 0, 1, 0},
-    {1, 0, 0, 1, 0},
-    {1, 0, 0, 1, 0},
-    {1, 0, 0, 1, 0}
-};
-static const char char_o[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_p[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 0},
-};
-static const char char_q[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0},
-    {0, 0, 0, 0, 1}
-};
-static const char char_r[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 1, 1, 1, 0},
-    {1, 0, 0, 1, 0}
-};
-static const char char_s[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {1, 0, 0, 0, 0},
-    {0, 1, 1, 1, 0},
-    {0, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_t[ROWS][COLS] = {
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 1, 1, 1, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 0},
-    {0, 0, 1, 0, 1},
-    {0, 0, 0, 1, 0}
-};
-static const char char_u[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
-};
-static const char char_v[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 0, 1, 0},
-    {0, 0, 1, 0, 0}
-};
-static const char char_w[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {1, 0, 1, 0, 1},
-    {1, 0, 1, 0, 1},
-    {0, 1, 0, 1, 0}
-};
-static const char char_x[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 0, 0, 0, 1},
-    {0, 1, 0, 1, 0},
-    {0, 1, 0, 1, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1}
-};
-static const char char_y[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 0, 0, 0, 1},
-    {1, 0, 0, 0, 1},
-    {0, 1, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 1, 1, 1, 0}
+
+// A glyph found past the font tables, keyed by codepoint and the font it was
+// built from
+struct glyph_entry {
+  struct hlist_node node;
+  struct rcu_head rcu;
+  const struct font *font;
+  u32 codepoint;
+  unsigned long lastUsed;  // jiffies of the last lookup, for eviction
+  struct glyph glyph;
 };
-static const char char_z[ROWS][COLS] = {
-    {0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0},
-    {1, 1, 1, 1, 1},
-    {0, 0, 0, 0, 1},
-    {0, 0, 0, 1, 0},
-    {0, 0, 1, 0, 0},
-    {1, 1, 1, 1, 1}
+
+// Glyphs for codepoints past the font tables that are worth drawing
+// themselves rather than as a plain letter or a block
+static const struct {
+  u32 codepoint;
+  u8 cols[GLYPH_COLS];
+} extraGlyphs[] = {
+    {0x00a3, {0x48, 0x7e, 0x49, 0x41, 0x42}},  // pound sign
+    {0x00b0, {0x02, 0x05, 0x05, 0x02, 0x00}},  // degree sign
+    {0x00b1, {0x44, 0x44, 0x5f, 0x44, 0x44}},  // plus-minus
+    {0x00d7, {0x22, 0x14, 0x08, 0x14, 0x22}},  // multiplication sign
+    {0x00f7, {0x08, 0x08, 0x2a, 0x08, 0x08}},  // division sign
+    {0x2013, {0x08, 0x08, 0x08, 0x08, 0x00}},  // en dash
+    {0x2014, {0x08, 0x08, 0x08, 0x08, 0x08}},  // em dash
+    {0x2018, {0x00, 0x00, 0x06, 0x01, 0x00}},  // left single quote
+    {0x2019, {0x00, 0x00, 0x04, 0x03, 0x00}},  // right single quote
+    {0x201c, {0x06, 0x01, 0x00, 0x06, 0x01}},  // left double quote
+    {0x201d, {0x04, 0x03, 0x00, 0x04, 0x03}},  // right double quote
+    {0x2022, {0x00, 0x1c, 0x1c, 0x1c, 0x00}},  // bullet
+    {0x2026, {0x40, 0x00, 0x40, 0x00, 0x40}},  // ellipsis
+    {0x20ac, {0x14, 0x3e, 0x55, 0x55, 0x41}},  // euro sign
+    {0x2190, {0x08, 0x1c, 0x2a, 0x08, 0x08}},  // left arrow
+    {0x2191, {0x04, 0x02, 0x7f, 0x02, 0x04}},  // up arrow
+    {0x2192, {0x08, 0x08, 0x2a, 0x1c, 0x08}},  // right arrow
+    {0x2193, {0x10, 0x20, 0x7f, 0x20, 0x10}},  // down arrow
 };
-// For any unmapped chars
-static const char char_unknown[ROWS][COLS] = {
-    {1, 1, 1, 1, 1},
-    {1, 1, 1, 1, 1},
-    {1, 1, 1, 1, 1},
-    {1, 1, 1, 1, 1},
-    {1, 1, 1, 1, 1},
-    {1, 1, 1, 1, 1},
-    {1, 1, 1, 1, 1}
+
+// The plain letter of each latin-1 character from U+00C0, drawn when the font
+// has nothing better. The two signs in between have their own glyphs above.
+static const char latin1Letters[] = "AAAAAAACEEEEIIIIDNOOOOO*OUUUUYPs"
+                                    "aaaaaaaceeeeiiiidnooooo/ouuuuypy";
+
+// The built in ascii font, each glyph drawn column by column from the left
+// with row 0 in the lowest bit. Every character it does not map shows as a
+// solid block, so the whole table starts out as blocks and the mapped ones
+// override them.
+static struct font builtinFont = {
+    .name = "builtin",
+    .glyphs = {
+        [0 ... FONT_GLYPHS - 1] = {0x7f, 0x7f, 0x7f, 0x7f, 0x7f},
+        [' '] = {0x00, 0x00, 0x00, 0x00, 0x00},
+        ['0'] = {0x3e, 0x51, 0x49, 0x45, 0x3e},
+        ['1'] = {0x44, 0x42, 0x7f, 0x40, 0x40},
+        ['2'] = {0x42, 0x61, 0x51, 0x49, 0x46},
+        ['3'] = {0x41, 0x41, 0x49, 0x4d, 0x3b},
+        ['4'] = {0x18, 0x14, 0x12, 0x7f, 0x10},
+        ['5'] = {0x47, 0x45, 0x45, 0x45, 0x39},
+        ['6'] = {0x3c, 0x4a, 0x49, 0x49, 0x30},
+        ['7'] = {0x01, 0x71, 0x09, 0x05, 0x03},
+        ['8'] = {0x36, 0x49, 0x49, 0x49, 0x36},
+        ['9'] = {0x06, 0x49, 0x49, 0x29, 0x1e},
+        [':'] = {0x00, 0x00, 0x36, 0x00, 0x00},
+        [';'] = {0x00, 0x40, 0x36, 0x00, 0x00},
+        ['<'] = {0x00, 0x08, 0x14, 0x22, 0x00},
+        ['='] = {0x14, 0x14, 0x14, 0x14, 0x14},
+        ['>'] = {0x00, 0x22, 0x14, 0x08, 0x00},
+        ['?'] = {0x02, 0x01, 0x51, 0x09, 0x06},
+        ['@'] = {0x02, 0x79, 0x65, 0x5d, 0x3e},
+        ['A'] = {0x7c, 0x0a, 0x09, 0x0a, 0x7c},
+        ['B'] = {0x7f, 0x49, 0x49, 0x49, 0x36},
+        ['C'] = {0x3e, 0x41, 0x41, 0x41, 0x22},
+        ['D'] = {0x7f, 0x41, 0x41, 0x22, 0x1c},
+        ['E'] = {0x7f, 0x49, 0x49, 0x49, 0x49},
+        ['F'] = {0x7f, 0x09, 0x09, 0x09, 0x09},
+        ['G'] = {0x3e, 0x41, 0x49, 0x49, 0x3a},
+        ['H'] = {0x7f, 0x08, 0x08, 0x08, 0x7f},
+        ['I'] = {0x41, 0x41, 0x7f, 0x41, 0x41},
+        ['J'] = {0x30, 0x40, 0x41, 0x41, 0x3f},
+        ['K'] = {0x7f, 0x08, 0x14, 0x22, 0x41},
+        ['L'] = {0x7f, 0x40, 0x40, 0x40, 0x60},
+        ['M'] = {0x7f, 0x02, 0x04, 0x02, 0x7f},
+        ['N'] = {0x7f, 0x02, 0x04, 0x08, 0x7f},
+        ['O'] = {0x3e, 0x41, 0x41, 0x41, 0x3e},
+        ['P'] = {0x7f, 0x09, 0x09, 0x09, 0x06},
+        ['Q'] = {0x3e, 0x41, 0x51, 0x21, 0x7e},
+        ['R'] = {0x7f, 0x09, 0x19, 0x29, 0x46},
+        ['S'] = {0x46, 0x49, 0x49, 0x49, 0x31},
+        ['T'] = {0x01, 0x01, 0x7f, 0x01, 0x01},
+        ['U'] = {0x3f, 0x40, 0x40, 0x40, 0x3f},
+        ['V'] = {0x0f, 0x30, 0x40, 0x30, 0x0f},
+        ['W'] = {0x7f, 0x20, 0x18, 0x20, 0x7f},
+        ['X'] = {0x63, 0x14, 0x08, 0x14, 0x63},
+        ['Y'] = {0x03, 0x04, 0x78, 0x04, 0x03},
+        ['Z'] = {0x61, 0x51, 0x49, 0x45, 0x43},
+        ['['] = {0x00, 0x7f, 0x41, 0x41, 0x00},
+        ['\\'] = {0x01, 0x06, 0x08, 0x30, 0x40},
+        [']'] = {0x00, 0x41, 0x41, 0x7f, 0x00},
+        ['^'] = {0x08, 0x04, 0x02, 0x04, 0x08},
+        ['_'] = {0x40, 0x40, 0x40, 0x40, 0x40},
+        ['`'] = {0x00, 0x00, 0x00, 0x01, 0x02},
+        ['a'] = {0x28, 0x54, 0x54, 0x54, 0x78},
+        ['b'] = {0x7f, 0x44, 0x44, 0x44, 0x38},
+        ['c'] = {0x38, 0x44, 0x44, 0x44, 0x28},
+        ['d'] = {0x38, 0x44, 0x44, 0x44, 0x3f},
+        ['e'] = {0x38, 0x54, 0x54, 0x54, 0x18},
+        ['f'] = {0x08, 0x7e, 0x09, 0x09, 0x02},
+        ['g'] = {0x0c, 0x52, 0x52, 0x52, 0x3c},
+        ['h'] = {0x7f, 0x08, 0x08, 0x08, 0x70},
+        ['i'] = {0x00, 0x74, 0x00, 0x00, 0x00},
+        ['j'] = {0x00, 0x40, 0x40, 0x34, 0x00},
+        ['k'] = {0x7f, 0x10, 0x28, 0x44, 0x00},
+        ['l'] = {0x41, 0x7f, 0x40, 0x00, 0x00},
+        ['m'] = {0x7c, 0x04, 0x1c, 0x04, 0x78},
+        ['n'] = {0x7c, 0x08, 0x04, 0x7c, 0x00},
+        ['o'] = {0x38, 0x44, 0x44, 0x44, 0x38},
+        ['p'] = {0x7c, 0x24, 0x24, 0x24, 0x18},
+        ['q'] = {0x18, 0x24, 0x24, 0x24, 0x58},
+        ['r'] = {0x7c, 0x24, 0x24, 0x64, 0x18},
+        ['s'] = {0x08, 0x54, 0x54, 0x54, 0x20},
+        ['t'] = {0x00, 0x04, 0x3f, 0x44, 0x20},
+        ['u'] = {0x3c, 0x40, 0x40, 0x40, 0x3c},
+        ['v'] = {0x1c, 0x20, 0x40, 0x20, 0x1c},
+        ['w'] = {0x3c, 0x40, 0x30, 0x40, 0x3c},
+        ['x'] = {0x64, 0x18, 0x00, 0x18, 0x64},
+        ['y'] = {0x0c, 0x50, 0x50, 0x50, 0x3c},
+        ['z'] = {0x44, 0x44, 0x64, 0x54, 0x4c},
+    },
 };
 
-const char (*character_get_array(char character))[ROWS][COLS] {
-    // c switch statements are just jump tables, but a char is just a number so it still works
-    switch (character) {
-        case ' ':
-        return &char_space;
-        case '0':
-        return &char_0;
-        case '1':
-        return &char_1;
-        case '2':
-        return &char_2;
-        case '3':
-        return &char_3;
-        case '4':
-        return &char_4;
-        case '5':
-        return &char_5;
-        case '6':
-        return &char_6;
-        case '7':
-        return &char_7;
-        case '8':
-        return &char_8;
-        case '9':
-        return &char_9;
-        case ':':
-        return &char_colon;
-        case ';':
-        return &char_semi_colon;
-        case '<':
-        return &char_less_than;
-        case '=':
-        return &char_equal;
-        case '>':
-        return &char_greater_than;
-        case '?':
-        return &char_question_mark;
-        case '@':
-        return &char_at;
-        case 'A':
-        return &char_A;
-        case 'B':
-        return &char_B;
-        case 'C':
-        return &char_C;
-        case 'D':
-        return &char_D;
-        case 'E':
-        return &char_E;
-        case 'F':
-        return &char_F;
-        case 'G':
-        return &char_G;
-        case 'H':
-        return &char_H;
-        case 'I':
-        return &char_I;
-        case 'J':
-        return &char_J;
-        case 'K':
-        return &char_K;
-        case 'L':
-        return &char_L;
-        case 'M':
-        return &char_M;
-        case 'N':
-        return &char_N;
-        case 'O':
-        return &char_O;
-        case 'P':
-        return &char_P;
-        case 'Q':
-        return &char_Q;
-        case 'R':
-        return &char_R;
-        case 'S':
-        return &char_S;
-        case 'T':
-        return &char_T;
-        case 'U':
-        return &char_U;
-        case 'V':
-        return &char_V;
-        case 'W':
-        return &char_W;
-        case 'X':
-        return &char_X;
-        case 'Y':
-        return &char_Y;
-        case 'Z':
-        return &char_Z;
-        case '[':
-        return &char_open_bracket;
-        case '\\':
-        return &char_backslash;
-        case ']':
-        return &char_close_bracket;
-        case '^':
-        return &char_caret;
-        case '_':
-        return &char_underscore;
-        case '`':
-        return &char_tick;
-        case 'a':
-        return &char_a;
-        case 'b':
-        return &char_b;
-        case 'c':
-        return &char_c;
-        case 'd':
-        return &char_d;
-        case 'e':
-        return &char_e;
-        case 'f':
-        return &char_f;
-        case 'g':
-        return &char_g;
-        case 'h':
-        return &char_h;
-        case 'i':
-        return &char_i;
-        case 'j':
-        return &char_j;
-        case 'k':
-        return &char_k;
-        case 'l':
-        return &char_l;
-        case 'm':
-        return &char_m;
-        case 'n':
-        return &char_n;
-        case 'o':
-        return &char_o;
-        case 'p':
-        return &char_p;
-        case 'q':
-        return &char_q;
-        case 'r':
-        return &char_r;
-        case 's':
-        return &char_s;
-        case 't':
-        return &char_t;
-        case 'u':
-        return &char_u;
-        case 'v':
-        return &char_v;
-        case 'w':
-        return &char_w;
-        case 'x':
-        return &char_x;
-        case 'y':
-        return &char_y;
-        case 'z':
-        return &char_z;
-        
-        default:
-        return &char_unknown;
+// Every font added so far, only freed when the module unloads, so the glyphs
+// of the active font can be read without a lock while another is switched in
+static LIST_HEAD(fonts);
+static DEFINE_MUTEX(fontLock);
+static const struct font *activeFont = &builtinFont;
+
+static int letterSpacing = 1;
+
+// What every character nothing else draws shows as
+static const u8 blockGlyph[GLYPH_COLS] = {0x7f, 0x7f, 0x7f, 0x7f, 0x7f};
+
+// Glyphs found past the font tables, read under rcu from the string and ticker
+// paths. Once GLYPH_CACHE_SIZE glyphs are in, each new one replaces the least
+// recently used, and it is emptied on a font switch.
+static DEFINE_HASHTABLE(glyphCache, GLYPH_CACHE_BITS);
+static DEFINE_SPINLOCK(glyphCacheLock);
+static int glyphCacheCount = 0;
+
+// Find the lit columns of a glyph
+static void glyph_measure(const u8 *cols, u8 *left, u8 *width) {
+  int first = GLYPH_COLS, last = -1;
+  for (int col = 0; col < GLYPH_COLS; col++) {
+    if (!cols[col]) continue;
+    first = min(first, col);
+    last = max(last, col);
+  }
+  // a blank glyph still has to leave a visible gap
+  *left = last < 0 ? 0 : first;
+  *width = last < 0 ? BLANK_GLYPH_COLS : last - first + 1;
+}
+
+static void font_measure(struct font *font) {
+  for (int c = 0; c < FONT_GLYPHS; c++) {
+    glyph_measure(font->glyphs[c], &font->left[c], &font->cols[c]);
+  }
+}
+
+static void glyph_cache_flush(void) {
+  struct glyph_entry *entry;
+  struct hlist_node *tmp;
+  unsigned long flags;
+  int bkt;
+  spin_lock_irqsave(&glyphCacheLock, flags);
+  hash_for_each_safe(glyphCache, bkt, tmp, entry, node) {
+    hash_del_rcu(&entry->node);
+    kfree_rcu(entry, rcu);
+  }
+  glyphCacheCount = 0;
+  spin_unlock_irqrestore(&glyphCacheLock, flags);
+}
+
+// Drop the least recently used glyph to make room. Callers hold glyphCacheLock.
+static void glyph_cache_evict(void) {
+  struct glyph_entry *entry, *oldest = NULL;
+  int bkt;
+  hash_for_each(glyphCache, bkt, entry, node) {
+    if (!oldest || time_before(entry->lastUsed, oldest->lastUsed)) {
+      oldest = entry;
+    }
+  }
+  if (!oldest) return;
+  hash_del_rcu(&oldest->node);
+  kfree_rcu(oldest, rcu);
+  glyphCacheCount--;
+}
+
+void characters_init(void) {
+  for (int c = 0; c < FONT_GLYPHS; c++) {
+    if (memcmp(builtinFont.glyphs[c], blockGlyph, GLYPH_COLS)) {
+      __set_bit(c, builtinFont.mapped);
+    }
+  }
+  font_measure(&builtinFont);
+  list_add_tail(&builtinFont.node, &fonts);
+}
+
+void characters_exit(void) {
+  struct font *font, *tmp;
+  WRITE_ONCE(activeFont, &builtinFont);
+  glyph_cache_flush();
+  // the cached glyphs are freed after a grace period
+  rcu_barrier();
+  list_for_each_entry_safe(font, tmp, &fonts, node) {
+    list_del(&font->node);
+    if (font != &builtinFont) kfree(font);
+  }
+}
+
+// Check a font file and build the font from it on top of the built in glyphs
+static struct font *font_parse(const char *name, const struct firmware *fw) {
+  const struct font_file_header *header = (const void *)fw->data;
+  struct font *font;
+  int count;
+
+  if (fw->size < sizeof(*header) ||
+      memcmp(header->magic, FONT_FILE_MAGIC, sizeof(header->magic)) ||
+      header->cols != GLYPH_COLS || header->rows != GLYPH_ROWS ||
+      header->last < header->first) {
+    return ERR_PTR(-EINVAL);
+  }
+  count = header->last - header->first + 1;
+  if (fw->size != sizeof(*header) + count * GLYPH_COLS) return ERR_PTR(-EINVAL);
+
+  font = kmemdup(&builtinFont, sizeof(*font), GFP_KERNEL);
+  if (!font) return ERR_PTR(-ENOMEM);
+  strscpy(font->name, name, sizeof(font->name));
+  memcpy(font->glyphs[header->first], fw->data + sizeof(*header),
+         count * GLYPH_COLS);
+  for (int c = header->first; c <= header->last; c++) {
+    for (int col = 0; col < GLYPH_COLS; col++) {
+      font->glyphs[c][col] &= GENMASK(GLYPH_ROWS - 1, 0);
     }
-}
\ No newline at end of file
+  }
+  bitmap_set(font->mapped, header->first, count);
+  font_measure(font);
+  return font;
+}
+
+int characters_set_font(const char *name, struct device *device) {
+  const struct firmware *fw;
+  struct font *font;
+  int ret;
+
+  if (strlen(name) >= FONT_NAME_SIZE) return -EINVAL;
+  // a plain file name in the firmware directory, never a path out of it
+  if (strchr(name, '/') || strstr(name, "..")) return -EINVAL;
+  mutex_lock(&fontLock);
+  list_for_each_entry(font, &fonts, node) {
+    if (!strcmp(font->name, name)) goto found;
+  }
+  ret = request_firmware(&fw, name, device);
+  if (ret) goto out;
+  font = font_parse(name, fw);
+  release_firmware(fw);
+  if (IS_ERR(font)) {
+    ret = PTR_ERR(font);
+    goto out;
+  }
+  list_add_tail(&font->node, &fonts);
+found:
+  if (font != activeFont) {
+    WRITE_ONCE(activeFont, font);
+    glyph_cache_flush();
+  }
+  ret = 0;
+out:
+  mutex_unlock(&fontLock);
+  return ret;
+}
+
+int characters_print_fonts(char *buf) {
+  const struct font *font;
+  int len = 0;
+  mutex_lock(&fontLock);
+  list_for_each_entry(font, &fonts, node) {
+    len += sysfs_emit_at(buf, len, "%c%s\n",
+                         font == READ_ONCE(activeFont) ? '*' : ' ', font->name);
+  }
+  mutex_unlock(&fontLock);
+  return len;
+}
+
+int character_utf8_length(char lead) {
+  u8 c = lead;
+  if (c < 0x80) return 1;
+  if ((c & 0xe0) == 0xc0) return 2;
+  if ((c & 0xf0) == 0xe0) return 3;
+  if ((c & 0xf8) == 0xf0) return 4;
+  return 1;  // a stray continuation byte or never valid
+}
+
+int character_decode(const char *text, int length, u32 *codepoint) {
+  unicode_t u;
+  int used;
+  // plain ascii, the common case
+  if (!(text[0] & 0x80)) {
+    *codepoint = (u8)text[0];
+    return 1;
+  }
+  used = utf8_to_utf32((const u8 *)text, length, &u);
+  if (used < 0) {
+    *codepoint = 0xfffd;
+    return 1;
+  }
+  *codepoint = u;
+  return used;
+}
+
+// Copy the glyph of a character of a font
+static void glyph_from_font(const struct font *font, u8 c,
+                            struct glyph *glyph) {
+  memcpy(glyph->cols, font->glyphs[c], GLYPH_COLS);
+  glyph->left = font->left[c];
+  glyph->width = font->cols[c];
+}
+
+// Work out the glyph of a codepoint the font does not map
+static void glyph_build(const struct font *font, u32 codepoint,
+                        struct glyph *glyph) {
+  for (int i = 0; i < ARRAY_SIZE(extraGlyphs); i++) {
+    if (extraGlyphs[i].codepoint != codepoint) continue;
+    memcpy(glyph->cols, extraGlyphs[i].cols, GLYPH_COLS);
+    glyph_measure(glyph->cols, &glyph->left, &glyph->width);
+    return;
+  }
+  if (codepoint == 0x00a0) codepoint = ' ';  // no-break space
+  if (codepoint >= 0x00c0 && codepoint <= 0x00ff) {
+    codepoint = latin1Letters[codepoint - 0x00c0];
+  }
+  if (codepoint < FONT_GLYPHS && test_bit(codepoint, font->mapped)) {
+    glyph_from_font(font, codepoint, glyph);
+    return;
+  }
+  memcpy(glyph->cols, blockGlyph, GLYPH_COLS);
+  glyph_measure(glyph->cols, &glyph->left, &glyph->width);
+}
+
+void character_lookup(u32 codepoint, struct glyph *glyph) {
+  const struct font *font = READ_ONCE(activeFont);
+  struct glyph_entry *entry;
+  unsigned long flags;
+
+  // everything the font maps, ascii above all, is a single index
+  if (codepoint < FONT_GLYPHS && test_bit(codepoint, font->mapped)) {
+    glyph_from_font(font, codepoint, glyph);
+    return;
+  }
+  rcu_read_lock();
+  hash_for_each_possible_rcu(glyphCache, entry, node, codepoint) {
+    if (entry->codepoint == codepoint && entry->font == font) {
+      *glyph = entry->glyph;
+      // racy, but only an eviction hint
+      if (entry->lastUsed != jiffies) WRITE_ONCE(entry->lastUsed, jiffies);
+      rcu_read_unlock();
+      return;
+    }
+  }
+  rcu_read_unlock();
+
+  glyph_build(font, codepoint, glyph);
+  // a font switch in between would leave an entry no lookup matches
+  if (font != READ_ONCE(activeFont)) return;
+  // the ticker looks glyphs up with its lock held
+  entry = kmalloc(sizeof(*entry), GFP_ATOMIC);
+  if (!entry) return;
+  entry->font = font;
+  entry->codepoint = codepoint;
+  entry->lastUsed = jiffies;
+  entry->glyph = *glyph;
+  spin_lock_irqsave(&glyphCacheLock, flags);
+  if (font == READ_ONCE(activeFont)) {
+    if (glyphCacheCount >= GLYPH_CACHE_SIZE) glyph_cache_evict();
+    hash_add_rcu(glyphCache, &entry->node, codepoint);
+    glyphCacheCount++;
+    entry = NULL;
+  }
+  spin_unlock_irqrestore(&glyphCacheLock, flags);
+  kfree(entry);
+}
+
+int character_scale(int rows) { return max(1, rows / GLYPH_ROWS); }
+
+int character_width(int rows) { return GLYPH_COLS * character_scale(rows); }
+
+matrix_col_t character_get_col(const u8 *glyph, int col, int rows) {
+  int scale = character_scale(rows);
+  // centered vertically when the display is taller than the scaled glyph
+  int top = max(0, (rows - GLYPH_ROWS * scale) / 2);
+  matrix_col_t mask = 0;
+  for (int row = 0; row < rows; row++) {
+    // nearest glyph row, squashed when the display is shorter than a glyph
+    int glyphRow = rows < GLYPH_ROWS ? row * GLYPH_ROWS / rows
+                                     : (row - top) / scale;
+    if (row < top || glyphRow >= GLYPH_ROWS) continue;
+    if (glyph[col / scale] & BIT(glyphRow)) mask |= BIT(row);
+  }
+  return mask;
+}
+
+int character_get_spacing(void) { return READ_ONCE(letterSpacing); }
+
+void character_set_spacing(int spacing) { WRITE_ONCE(letterSpacing, spacing); }
+
+int character_advance(const struct glyph *glyph, int rows) {
+  return glyph->width * character_scale(rows);
+}
+
+int character_gap(int rows) {
+  return character_get_spacing() * character_scale(rows);
+}
+
+matrix_col_t character_string_col(const struct glyph *glyph, int col,
+                                  int rows) {
+  int left = glyph->left * character_scale(rows);
+  return character_get_col(glyph->cols, left + col, rows);
+}
@@ -1,4 +1,77 @@
+#include <linux/device.h>
+
 #include "matrix.h"
 
-// returns a pointer to a 2D array of "pixels" for a given character, or a block for an unknown character
-const char (*character_get_array(char character))[ROWS][COLS];
+// the size of the glyphs in the fonts
+#define GLYPH_ROWS 7
+#define GLYPH_COLS 5
+// a font has a glyph for every value of a char
+#define FONT_GLYPHS 256
+#define FONT_NAME_SIZE 64
+// Glyph columns a blank glyph such as the space advances a string by
+#define BLANK_GLYPH_COLS 2
+// The most glyph columns of spacing between two characters
+#define MAX_LETTER_SPACING 8
+// Glyphs outside the font tables kept ready in the glyph cache
+#define GLYPH_CACHE_BITS 6
+#define GLYPH_CACHE_SIZE 128
+
+// A glyph ready to draw: GLYPH_COLS column bitmasks with bit r lit for row r,
+// and which of those columns a string shows
+struct glyph {
+  u8 cols[GLYPH_COLS];
+  u8 left;   // first lit column
+  u8 width;  // columns from the first to the last lit one
+};
+
+// A font file, loaded with request_firmware (from /lib/firmware), is this
+// header followed by the glyphs of the characters first to last, GLYPH_COLS
+// bytes each with bit r of a column lit for row r. Characters it leaves out
+// keep their built in glyph.
+#define FONT_FILE_MAGIC "LMF1"
+struct font_file_header {
+  char magic[4];
+  u8 cols;  // GLYPH_COLS
+  u8 rows;  // GLYPH_ROWS
+  u8 first;
+  u8 last;
+};
+
+// set up the built in font and measure its glyphs, before any string is drawn
+void characters_init(void);
+// free every loaded font
+void characters_exit(void);
+// switch to a font added before, "builtin", or a font file loaded now
+int characters_set_font(const char *name, struct device *device);
+// list every font, the one in use marked with a *
+int characters_print_fonts(char *buf);
+// bytes in the UTF-8 sequence a lead byte starts, 1 for a byte that cannot
+// start one
+int character_utf8_length(char lead);
+// Decode the UTF-8 character at the start of `text` and return its length in
+// bytes. Invalid bytes are taken one at a time as U+FFFD.
+int character_decode(const char *text, int length, u32 *codepoint);
+// Find the glyph of a codepoint: the current font for the characters it maps,
+// then the extra built in glyphs, then the plain letter of an accented one.
+// Anything else is a solid block. Glyphs found past the font are cached.
+void character_lookup(u32 codepoint, struct glyph *glyph);
+// how many times larger glyphs are drawn on a display `rows` tall
+int character_scale(int rows);
+// how many display columns a glyph takes on a display `rows` tall
+int character_width(int rows);
+// the lit rows of one column of a glyph drawn on a display `rows` tall, as a
+// framebuffer column. col counts display columns of the glyph.
+matrix_col_t character_get_col(const u8 *glyph, int col, int rows);
+
+// glyph columns left blank between two characters of a string
+int character_get_spacing(void);
+void character_set_spacing(int spacing);
+// how many display columns a glyph takes in a string, from its first to its
+// last lit column, not counting the spacing after it
+int character_advance(const struct glyph *glyph, int rows);
+// display columns of spacing after every character of a string
+int character_gap(int rows);
+// column `col` of a glyph as drawn in a string, counted from its first lit
+// column
+matrix_col_t character_string_col(const struct glyph *glyph, int col,
+                                  int rows);
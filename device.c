@@ -0,0 +1,222 @@
+#include "device.h"
+
+#include <linux/atomic.h>
+#include <linux/fs.h>
+#include <linux/irq_work.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "matrix.h"
+
+// What each open file has already been told about
+struct device_file {
+  u32 events;  // LEDMATRIX_EVENT_* to wake for
+  u64 cycles;
+  u64 scrolls;
+};
+
+static atomic64_t eventCycles = ATOMIC64_INIT(0);
+static atomic64_t eventScrolls = ATOMIC64_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(eventWait);
+
+// One packed frame shared by every opener, committed with LEDMATRIX_COMMIT
+static u8 *frameBuffer = NULL;
+static size_t mmapSize = 0;
+
+// Scan cycles end in the hrtimer callback, which stays in hard irq context even
+// on PREEMPT_RT where the wait queue lock may sleep, so wake from irq_work
+static void device_wake(struct irq_work *work) {
+  wake_up_interruptible(&eventWait);
+}
+static DEFINE_IRQ_WORK(eventWork, device_wake);
+
+void device_notify(int event) {
+  if (event == LEDMATRIX_EVENT_CYCLE) {
+    atomic64_inc(&eventCycles);
+  } else {
+    atomic64_inc(&eventScrolls);
+  }
+  // a cycle ends a hundred times a second, only wake when someone waits
+  if (wq_has_sleeper(&eventWait)) irq_work_queue(&eventWork);
+}
+
+static bool device_event_pending(const struct device_file *f) {
+  return ((f->events & LEDMATRIX_EVENT_CYCLE) &&
+          atomic64_read(&eventCycles) != f->cycles) ||
+         ((f->events & LEDMATRIX_EVENT_SCROLL) &&
+          atomic64_read(&eventScrolls) != f->scrolls);
+}
+
+static int device_open(struct inode *inode, struct file *file) {
+  struct device_file *f = kzalloc(sizeof(*f), GFP_KERNEL);
+  if (!f) return -ENOMEM;
+  // only events after opening count
+  f->events = LEDMATRIX_EVENT_CYCLE | LEDMATRIX_EVENT_SCROLL;
+  f->cycles = atomic64_read(&eventCycles);
+  f->scrolls = atomic64_read(&eventScrolls);
+  file->private_data = f;
+  return 0;
+}
+
+static int device_release(struct inode *inode, struct file *file) {
+  kfree(file->private_data);
+  return 0;
+}
+
+// Wait for the next selected event, then return the event counters
+static ssize_t device_read(struct file *file, char __user *buf, size_t count,
+                           loff_t *ppos) {
+  struct device_file *f = file->private_data;
+  struct ledmatrix_event event;
+  int ret;
+
+  if (count < sizeof(event)) return -EINVAL;
+  if (!device_event_pending(f)) {
+    if (file->f_flags & O_NONBLOCK) return -EAGAIN;
+    ret = wait_event_interruptible(eventWait, device_event_pending(f));
+    if (ret) return ret;
+  }
+  event.cycles = atomic64_read(&eventCycles);
+  event.scrolls = atomic64_read(&eventScrolls);
+  f->cycles = event.cycles;
+  f->scrolls = event.scrolls;
+  if (copy_to_user(buf, &event, sizeof(event))) return -EFAULT;
+  return sizeof(event);
+}
+
+// A whole packed frame, shown in one step like the frame attribute
+static ssize_t device_write(struct file *file, const char __user *buf,
+                            size_t count, loff_t *ppos) {
+  u8 *frame;
+  if (count != matrix_get_frame_size()) return -EINVAL;
+  frame = memdup_user(buf, count);
+  if (IS_ERR(frame)) return PTR_ERR(frame);
+  matrix_set_frame(frame);
+  kfree(frame);
+  return count;
+}
+
+static __poll_t device_poll(struct file *file, poll_table *wait) {
+  poll_wait(file, &eventWait, wait);
+  if (device_event_pending(file->private_data)) return EPOLLIN | EPOLLRDNORM;
+  return 0;
+}
+
+// Map the shared frame buffer, writes to it show up on LEDMATRIX_COMMIT
+static int device_mmap(struct file *file, struct vm_area_struct *vma) {
+  return remap_vmalloc_range(vma, frameBuffer, vma->vm_pgoff);
+}
+
+// Copy an animation in from user space and start playing it
+static int device_play(const struct ledmatrix_animation __user *arg) {
+  struct ledmatrix_animation animation;
+  u32 *durations;
+  u8 *frames;
+  int ret;
+
+  if (copy_from_user(&animation, arg, sizeof(animation))) return -EFAULT;
+  if (!animation.count || animation.count > MATRIX_MAX_FRAMES ||
+      animation.loops > INT_MAX) {
+    return -EINVAL;
+  }
+  durations = memdup_user(u64_to_user_ptr(animation.durations),
+                          animation.count * sizeof(u32));
+  if (IS_ERR(durations)) return PTR_ERR(durations);
+  frames = vmemdup_user(u64_to_user_ptr(animation.frames),
+                        animation.count * matrix_get_frame_size());
+  if (IS_ERR(frames)) {
+    kfree(durations);
+    return PTR_ERR(frames);
+  }
+  ret = matrix_set_animation(frames, durations, animation.count,
+                             animation.loops);
+  kvfree(frames);
+  kfree(durations);
+  return ret;
+}
+
+static long device_ioctl(struct file *file, unsigned int cmd,
+                         unsigned long arg) {
+  struct device_file *f = file->private_data;
+  struct ledmatrix_info info;
+  u32 events;
+
+  switch (cmd) {
+    case LEDMATRIX_COMMIT:
+      // the image is copied, so the buffer can be drawn into again right away
+      matrix_set_frame(frameBuffer);
+      return 0;
+    case LEDMATRIX_GET_INFO:
+      info.rows = matrix_get_rows();
+      info.width = matrix_get_width();
+      info.frameSize = matrix_get_frame_size();
+      info.mmapSize = mmapSize;
+      if (copy_to_user((void __user *)arg, &info, sizeof(info))) return -EFAULT;
+      return 0;
+    case LEDMATRIX_SET_EVENTS:
+      if (get_user(events, (u32 __user *)arg)) return -EFAULT;
+      if (events & ~(LEDMATRIX_EVENT_CYCLE | LEDMATRIX_EVENT_SCROLL)) {
+        return -EINVAL;
+      }
+      f->events = events;
+      return 0;
+    case LEDMATRIX_PLAY:
+      return device_play((const struct ledmatrix_animation __user *)arg);
+  }
+  return -ENOTTY;
+}
+
+static const struct file_operations device_fops = {
+    .owner = THIS_MODULE,
+    .open = device_open,
+    .release = device_release,
+    .read = device_read,
+    .write = device_write,
+    .poll = device_poll,
+    .mmap = device_mmap,
+    .unlocked_ioctl = device_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = noop_llseek,
+};
+
+static struct miscdevice matrixDevice = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "ledmatrix",
+    .fops = &device_fops,
+    .mode = 0664,
+};
+
+struct device *device_get(void) {
+  return frameBuffer ? matrixDevice.this_device : NULL;
+}
+
+int device_init(void) {
+  int ret;
+  mmapSize = PAGE_ALIGN(matrix_get_frame_size());
+  // vmalloc_user zeroes the buffer and allows remap_vmalloc_range
+  frameBuffer = vmalloc_user(mmapSize);
+  if (!frameBuffer) return -ENOMEM;
+  ret = misc_register(&matrixDevice);
+  if (ret) {
+    vfree(frameBuffer);
+    frameBuffer = NULL;
+    return ret;
+  }
+  printk(KERN_INFO "Registered /dev/%s\n", matrixDevice.name);
+  return 0;
+}
+
+void device_exit(void) {
+  if (!frameBuffer) return;  // never registered
+  misc_deregister(&matrixDevice);
+  irq_work_sync(&eventWork);
+  vfree(frameBuffer);
+  frameBuffer = NULL;
+}
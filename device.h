@@ -0,0 +1,10 @@
+#include "led-matrix-dev.h"
+
+// Register /dev/ledmatrix, once the matrix is initialized
+int device_init(void);
+// Remove the device, after the timers that report events have stopped
+void device_exit(void);
+// The device of /dev/ledmatrix, NULL when it is not registered
+struct device *device_get(void);
+// Count an event and wake readers waiting for it. Safe from hard irq context.
+void device_notify(int event);
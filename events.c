@@ -0,0 +1,76 @@
+#include "events.h"
+
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/sysfs.h>
+
+static const char *const eventNames[] = {
+    [MATRIX_EVENT_WRAP] = "wrap",
+    [MATRIX_EVENT_END] = "end",
+    [MATRIX_EVENT_COMMIT] = "commit",
+};
+
+// The latest events as a ring, eventSequence is the newest one
+static struct event_record eventHistory[EVENT_HISTORY];
+static u64 eventSequence = 0;
+// Events are raised from the frame timer as well as from writers
+static DEFINE_SPINLOCK(eventLock);
+
+// The attributes to wake pollers of, NULL while they do not exist.
+// kernfs_notify only queues the wakeup, so it can be called under eventLock.
+static struct kernfs_node *eventsNode = NULL;
+static struct kernfs_node *stringNode = NULL;
+
+void events_init(struct kobject *kobj) {
+  unsigned long flags;
+  struct kernfs_node *events = sysfs_get_dirent(kobj->sd, "events");
+  struct kernfs_node *string = sysfs_get_dirent(kobj->sd, "string");
+  spin_lock_irqsave(&eventLock, flags);
+  eventsNode = events;
+  stringNode = string;
+  spin_unlock_irqrestore(&eventLock, flags);
+}
+
+void events_exit(void) {
+  unsigned long flags;
+  struct kernfs_node *events, *string;
+  spin_lock_irqsave(&eventLock, flags);
+  events = eventsNode;
+  string = stringNode;
+  eventsNode = NULL;
+  stringNode = NULL;
+  spin_unlock_irqrestore(&eventLock, flags);
+  sysfs_put(events);
+  sysfs_put(string);
+}
+
+void events_raise(enum matrix_event type) {
+  unsigned long flags;
+  struct event_record *record;
+
+  spin_lock_irqsave(&eventLock, flags);
+  eventSequence++;
+  record = &eventHistory[eventSequence % EVENT_HISTORY];
+  record->sequence = eventSequence;
+  record->nsec = ktime_get_ns();
+  record->type = type;
+  if (eventsNode) kernfs_notify(eventsNode);
+  // the string attribute tells when the string has been shown in full
+  if (stringNode && type == MATRIX_EVENT_WRAP) kernfs_notify(stringNode);
+  spin_unlock_irqrestore(&eventLock, flags);
+}
+
+int events_get(struct event_record records[EVENT_HISTORY]) {
+  unsigned long flags;
+  int count;
+  spin_lock_irqsave(&eventLock, flags);
+  count = min_t(u64, eventSequence, EVENT_HISTORY);
+  for (int i = 0; i < count; i++) {
+    u64 sequence = eventSequence - count + 1 + i;
+    records[i] = eventHistory[sequence % EVENT_HISTORY];
+  }
+  spin_unlock_irqrestore(&eventLock, flags);
+  return count;
+}
+
+const char *events_name(enum matrix_event type) { return eventNames[type]; }
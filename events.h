@@ -0,0 +1,29 @@
+#include <linux/kobject.h>
+#include <linux/types.h>
+
+// How many of the latest events the events attribute shows
+#define EVENT_HISTORY 16
+
+enum matrix_event {
+  MATRIX_EVENT_WRAP,    // a scrolling string or an animation loop started over
+  MATRIX_EVENT_END,     // an animation finished showing its last frame
+  MATRIX_EVENT_COMMIT,  // a new image replaced the framebuffer
+};
+
+struct event_record {
+  u64 sequence;  // counts every event since loading, from 1
+  u64 nsec;      // CLOCK_MONOTONIC time it happened
+  enum matrix_event type;
+};
+
+// Start notifying pollers of the events and string attributes of `kobj`
+void events_init(struct kobject *kobj);
+// Stop notifying, before the attributes are removed
+void events_exit(void);
+// Record an event and wake anyone polling the attributes. Safe from any
+// context.
+void events_raise(enum matrix_event type);
+// Copy out the latest events, oldest first, and return how many there are
+int events_get(struct event_record records[EVENT_HISTORY]);
+// Name of an event type
+const char *events_name(enum matrix_event type);
@@ -0,0 +1,124 @@
+#include "latency.h"
+
+#include <linux/debugfs.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+
+// Bucket b holds latencies of [2^(b-1), 2^b) nanoseconds, bucket 0 holds 0ns.
+// The last bucket also collects everything above ~1 second.
+#define LATENCY_BUCKETS 32
+
+struct latency_hist {
+  unsigned long buckets[LATENCY_BUCKETS];
+  unsigned long count;
+  u64 min;  // nanoseconds
+  u64 max;
+};
+
+struct latency_hists {
+  struct latency_hist source[LATENCY_SOURCES];
+};
+
+// Each cpu only ever writes its own copy, so recording needs no locks. Every
+// source is recorded from a single context (timer irq, thread or worker).
+static DEFINE_PER_CPU(struct latency_hists, latencyHists);
+
+static const char *const latencyNames[] = {
+    [LATENCY_SCANLINE] = "scanline_latency",
+    [LATENCY_FRAME] = "frame_latency",
+};
+
+static struct dentry *debugDir = NULL;
+
+void latency_record(enum latency_source source, ktime_t expires) {
+  struct latency_hist *hist;
+  s64 delta = ktime_to_ns(ktime_sub(ktime_get(), expires));
+  u64 ns = delta > 0 ? delta : 0;
+  int bucket = min(fls64(ns), LATENCY_BUCKETS - 1);
+
+  hist = &get_cpu_ptr(&latencyHists)->source[source];
+  if (!hist->count || ns < hist->min) hist->min = ns;
+  if (ns > hist->max) hist->max = ns;
+  hist->buckets[bucket]++;
+  hist->count++;
+  put_cpu_ptr(&latencyHists);
+}
+
+void latency_reset(void) {
+  int cpu;
+  for_each_possible_cpu(cpu) {
+    memset(per_cpu_ptr(&latencyHists, cpu), 0, sizeof(struct latency_hists));
+  }
+}
+
+// Upper bound in nanoseconds of the bucket holding the given percentile
+static u64 latency_percentile(const struct latency_hist *hist, int percent) {
+  unsigned long target = DIV_ROUND_UP(hist->count * percent, 100);
+  unsigned long seen = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += hist->buckets[b];
+    if (seen >= target) return min_t(u64, (1ULL << b) - 1, hist->max);
+  }
+  return hist->max;
+}
+
+// Sum the per cpu histograms for a source and print a summary and the buckets
+static int latency_show(struct seq_file *s, void *unused) {
+  enum latency_source source = (uintptr_t)s->private;
+  struct latency_hist total = {0};
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    const struct latency_hist *hist =
+        &per_cpu_ptr(&latencyHists, cpu)->source[source];
+    if (!hist->count) continue;
+    if (!total.count || hist->min < total.min) total.min = hist->min;
+    if (hist->max > total.max) total.max = hist->max;
+    total.count += hist->count;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+      total.buckets[b] += hist->buckets[b];
+    }
+  }
+
+  seq_printf(s, "count %lu\n", total.count);
+  if (!total.count) return 0;
+  seq_printf(s, "min %llu ns\nmax %llu ns\n", total.min, total.max);
+  seq_printf(s, "p50 %llu ns\np99 %llu ns\n", latency_percentile(&total, 50),
+             latency_percentile(&total, 99));
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    if (!total.buckets[b]) continue;
+    seq_printf(s, "< %llu ns: %lu\n", 1ULL << b, total.buckets[b]);
+  }
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+// Any write to the reset file clears the histograms
+static ssize_t latency_reset_write(struct file *file, const char __user *buf,
+                                   size_t count, loff_t *ppos) {
+  latency_reset();
+  return count;
+}
+
+static const struct file_operations latency_reset_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = latency_reset_write,
+    .llseek = noop_llseek,
+};
+
+void latency_init(void) {
+  // debugfs is optional, the module works the same without it
+  debugDir = debugfs_create_dir("led-matrix", NULL);
+  for (int i = 0; i < LATENCY_SOURCES; i++) {
+    debugfs_create_file(latencyNames[i], 0444, debugDir, (void *)(uintptr_t)i,
+                        &latency_fops);
+  }
+  debugfs_create_file("reset", 0200, debugDir, NULL, &latency_reset_fops);
+}
+
+void latency_exit(void) {
+  debugfs_remove_recursive(debugDir);
+  debugDir = NULL;
+}
\ No newline at end of file
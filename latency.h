@@ -0,0 +1,17 @@
+#include <linux/ktime.h>
+
+// The places where timer expiry to GPIO write latency is measured
+enum latency_source {
+  LATENCY_SCANLINE,  // updateScanLine, or the scanline timer callback
+  LATENCY_FRAME,     // updateFrame
+  LATENCY_SOURCES
+};
+
+// Create the /sys/kernel/debug/led-matrix/ histograms
+void latency_init(void);
+// Remove the debugfs files
+void latency_exit(void);
+// Record how late the work for a timer that expired at `expires` finished
+void latency_record(enum latency_source source, ktime_t expires);
+// Clear every histogram
+void latency_reset(void);
\ No newline at end of file
@@ -0,0 +1,43 @@
+// Interface of /dev/ledmatrix, shared with user space programs
+#ifndef LED_MATRIX_DEV_H
+#define LED_MATRIX_DEV_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+// Events read() and poll() wait for, selected with LEDMATRIX_SET_EVENTS
+#define LEDMATRIX_EVENT_CYCLE (1 << 0)   // a full scan of the display finished
+#define LEDMATRIX_EVENT_SCROLL (1 << 1)  // a scrolling image moved one column
+
+// Returned by read(): how many of each event have happened since loading
+struct ledmatrix_event {
+  __u64 cycles;
+  __u64 scrolls;
+};
+
+struct ledmatrix_info {
+  __u32 rows;       // rows of the display
+  __u32 width;      // columns of all panels together
+  __u32 frameSize;  // bytes of one packed frame, as in the frame attribute
+  __u32 mmapSize;   // bytes to mmap, the frame rounded up to a page
+};
+
+// An animation played back by the kernel, see LEDMATRIX_PLAY
+struct ledmatrix_animation {
+  __u32 count;      // frames, at most 1024
+  __u32 loops;      // times to play it, 0 for ever
+  __u64 durations;  // pointer to count __u32 microseconds, each at least 1000
+  __u64 frames;     // pointer to count packed frames back to back
+};
+
+#define LEDMATRIX_IOC_MAGIC 'l'
+// Show the frame in the mmap'd buffer
+#define LEDMATRIX_COMMIT _IO(LEDMATRIX_IOC_MAGIC, 0)
+#define LEDMATRIX_GET_INFO _IOR(LEDMATRIX_IOC_MAGIC, 1, struct ledmatrix_info)
+// Mask of LEDMATRIX_EVENT_* this file wakes for, both by default
+#define LEDMATRIX_SET_EVENTS _IOW(LEDMATRIX_IOC_MAGIC, 2, __u32)
+// Upload and start an animation, any other image stops it
+#define LEDMATRIX_PLAY \
+  _IOW(LEDMATRIX_IOC_MAGIC, 3, struct ledmatrix_animation)
+
+#endif
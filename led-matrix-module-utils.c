@@ -1,47 +1,74 @@
 #include <linux/ctype.h>
+#include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/string.h>
 #include <stdbool.h>
 
+#include "characters.h"
+#include "device.h"
+#include "events.h"
 #include "led-matrix-module.h"
+#include "playlist.h"
 #include "matrix.h"
+#include "ticker.h"
 #include "timer.h"
 
-static char character = 'A';  // default starting character
+// default starting character, kept as the UTF-8 that was written
+static char character[5] = "A";
 static int fps = 0;
 static int scrollingFps = DEFAULT_SCROLL_FPS;
 static char *string = NULL;
+// Guards string between concurrent string stores and shows. The framebuffer
+// itself serializes its own writers.
+static DEFINE_MUTEX(stringLock);
+// Whether a transaction was begun through the transaction attribute, guarded
+// by transactionLock. The transaction of each write to rows, cols, pixels or
+// intensities also holds it, so the nested transactions of two writers never
+// interleave.
+static bool transactionOpen = false;
+static DEFINE_MUTEX(transactionLock);
+
+// Apply every edit of one write at once, or none of them when one is invalid
+static ssize_t store_edits(const char *buf, size_t count,
+                           int (*apply)(const char *buf)) {
+  int ret;
+  mutex_lock(&transactionLock);
+  ret = matrix_begin(false);
+  if (ret) goto out;
+  ret = apply(buf);
+  // inside an open transaction this drops only this write's edits
+  if (ret) {
+    matrix_abort();
+  } else {
+    matrix_commit();
+  }
+out:
+  mutex_unlock(&transactionLock);
+  if (ret) return ret;
+  fps = 0;
+  return count;
+}
 
 // Which rows are completly lit
 ssize_t rows_show(struct kobject *kobj, struct kobj_attribute *attr,
                   char *buf) {
-  const char **currentFramebuffer = matrix_get_pixels();
-  char *originalStart = buf;
-  int ret;
-
-  for (int row = 0; row < ROWS; row++) {
-    bool entireRowLit = true;
-    for (int col = 0; col < COLS; col++) {
-      if (!(currentFramebuffer)[row][col]) {
-        entireRowLit = false;
-        break;
-      }
-    }
+  matrix_col_t litRows = matrix_col_mask();
+  int len = 0;
 
-    if (entireRowLit) {  
-      ret = sprintf(buf, "%d ", row + 1);
-      if (ret < 0) return ret;
-      buf += ret;  // advance the buffer pointer
-    }
+  // a row is entirely lit if it is lit in every column
+  for (int col = 0; col < matrix_get_width(); col++) {
+    litRows &= matrix_get_col(col);
   }
 
-  ret = sprintf(buf, "\n");
-  if (ret < 0) return ret;
-  buf += ret;
-  return buf - originalStart;  // return the length of the string
+  for (int row = 0; row < matrix_get_rows(); row++) {
+    if (litRows & BIT(row)) len += sysfs_emit_at(buf, len, "%d ", row + 1);
+  }
+  // sysfs_emit_at stops at the end of the page on large displays
+  len += sysfs_emit_at(buf, len, "\n");
+  return len;
 }
 
-ssize_t rows_store(struct kobject *kobj, struct kobj_attribute *attr,
-                   const char *buf, size_t count) {
+static int rows_apply(const char *buf) {
   int bufIndex = 0;
   int row, charsRead;
 
@@ -51,7 +78,7 @@ ssize_t rows_store(struct kobject *kobj, struct kobj_attribute *attr,
       if (row == 0) {
         // clear the matrix
         matrix_set_clear();
-        return count;
+        return 0;
       }
       if (matrix_check_row(row - 1) && matrix_check_row((-row) - 1)) {
         // requested row is invalid
@@ -72,44 +99,28 @@ ssize_t rows_store(struct kobject *kobj, struct kobj_attribute *attr,
     bufIndex += charsRead;  // skip over the characters we just read
     while (isspace(buf[bufIndex])) bufIndex++;  // skip over whitespace
   }
-  fps = 0;
-  return count;
+  return 0;
+}
+
+ssize_t rows_store(struct kobject *kobj, struct kobj_attribute *attr,
+                   const char *buf, size_t count) {
+  return store_edits(buf, count, rows_apply);
 }
 
 // Indicates which columns are completly lit
 ssize_t col_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf) {
-  const char **currentFramebuffer = matrix_get_pixels();
-  char *originalStart = buf;
-  int ret;
-
-  for (int col = 0; col < COLS; col++) {
-    bool entireColLit = true;
-    for (int row = 0; row < ROWS; row++) {
-      printk(KERN_INFO "row %d, col %d, val %d\n", row, col,
-             (currentFramebuffer)[row][col]);
-
-      if (!(currentFramebuffer)[row][col]) {
-        entireColLit = false;
-        break;
-      }
-    }
+  int len = 0;
 
-    if (entireColLit) {
-      printk(KERN_INFO "col %d is lit\n", col + 1);
-      ret = sprintf(buf, "%d ", col + 1);
-      if (ret < 0) return ret;
-      buf += ret;
+  for (int col = 0; col < matrix_get_width(); col++) {
+    if (matrix_get_col(col) == matrix_col_mask()) {
+      len += sysfs_emit_at(buf, len, "%d ", col + 1);
     }
   }
-
-  ret = sprintf(buf, "\n");
-  if (ret < 0) return ret;
-  buf += ret;
-  return buf - originalStart;
+  len += sysfs_emit_at(buf, len, "\n");
+  return len;
 }
 
-ssize_t col_store(struct kobject *kobj, struct kobj_attribute *attr,
-                  const char *buf, size_t count) {
+static int col_apply(const char *buf) {
   int bufIndex = 0;
   int col, charsRead;
 
@@ -119,7 +130,7 @@ ssize_t col_store(struct kobject *kobj, struct kobj_attribute *attr,
       if (col == 0) {
         // clear the matrix
         matrix_set_clear();
-        return count;
+        return 0;
       }
       if (matrix_check_col(col - 1) && matrix_check_col((-col) - 1)) {
         // requested col is invalid
@@ -140,25 +151,34 @@ ssize_t col_store(struct kobject *kobj, struct kobj_attribute *attr,
     bufIndex += charsRead;  // skip over the characters we just read
     while (isspace(buf[bufIndex])) bufIndex++;  // skip over whitespace
   }
-  fps = 0;
-  return count;
+  return 0;
+}
+
+ssize_t col_store(struct kobject *kobj, struct kobj_attribute *attr,
+                  const char *buf, size_t count) {
+  return store_edits(buf, count, col_apply);
 }
 
 ssize_t character_show(struct kobject *kobj, struct kobj_attribute *attr,
                        char *buf) {
-  return sprintf(buf, "%c\n", character);
+  return sprintf(buf, "%s\n", character);
 }
 
 ssize_t character_store(struct kobject *kobj, struct kobj_attribute *attr,
                         const char *buf, size_t count) {
-  character = buf[0];
-  matrix_set_character(character);
+  u32 codepoint;
+  int length = character_decode(buf, count, &codepoint);
+  memcpy(character, buf, length);
+  character[length] = 0;
+  matrix_set_character(codepoint);
   fps = 0;
   return count;
 }
 
 ssize_t fps_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf) {
-  return sprintf(buf, "%d\n", fps);
+  // a playlist message scrolls at its own rate
+  int messageFps = playlist_get_fps();
+  return sprintf(buf, "%d\n", messageFps ? messageFps : fps);
 }
 
 // converts fps frequency to period and updates the timer
@@ -189,28 +209,20 @@ ssize_t fps_store(struct kobject *kobj, struct kobj_attribute *attr,
 
 ssize_t pixels_show(struct kobject *kobj, struct kobj_attribute *attr,
                     char *buf) {
-  const char **currentFramebuffer = matrix_get_pixels();
-  char *originalStart = buf;  // for calculating length at the the end
-  int ret;
+  int len = 0;
 
-  for (int row = 0; row < ROWS; row++) {
-    for (int col = 0; col < COLS; col++) {
-      if ((currentFramebuffer)[row][col]) {
-        int ret = sprintf(buf, "%d,%d ", col + 1, row + 1);
-        if (ret < 0) return ret;
-        buf += ret;
+  for (int row = 0; row < matrix_get_rows(); row++) {
+    for (int col = 0; col < matrix_get_width(); col++) {
+      if (matrix_get_col(col) & BIT(row)) {
+        len += sysfs_emit_at(buf, len, "%d,%d ", col + 1, row + 1);
       }
     }
   }
-
-  ret = sprintf(buf, "\n");
-  if (ret < 0) return ret;
-  buf += ret;
-  return buf - originalStart;
+  len += sysfs_emit_at(buf, len, "\n");
+  return len;
 }
 
-ssize_t pixels_store(struct kobject *kobj, struct kobj_attribute *attr,
-                     const char *buf, size_t count) {
+static int pixels_apply(const char *buf) {
   int i = 0;
   int row, col, charsRead;
   while (buf[i] != '\0') {
@@ -219,7 +231,7 @@ ssize_t pixels_store(struct kobject *kobj, struct kobj_attribute *attr,
       if (row == 0 && col == 0) {
         // clear the matrix
         matrix_set_clear();
-        return count;
+        return 0;
       }
       if (matrix_check_pixel(row - 1, col - 1) &&
           matrix_check_pixel(row - 1, (-col) - 1)) {
@@ -234,7 +246,6 @@ ssize_t pixels_store(struct kobject *kobj, struct kobj_attribute *attr,
         // requested pixel is positive, so set pixel
         matrix_set_pixel(row - 1, col - 1, 1);
       }
-      matrix_set_pixel(row - 1, col - 1, 1);
     } else {  // read failed, didn't match format
       return -EINVAL;
     }
@@ -243,34 +254,371 @@ ssize_t pixels_store(struct kobject *kobj, struct kobj_attribute *attr,
     while (isspace(buf[i])) i++;  // skip over whitespace
   }
 
+  return 0;
+}
+
+ssize_t pixels_store(struct kobject *kobj, struct kobj_attribute *attr,
+                     const char *buf, size_t count) {
+  return store_edits(buf, count, pixels_apply);
+}
+
+ssize_t intensities_show(struct kobject *kobj, struct kobj_attribute *attr,
+                         char *buf) {
+  int len = 0;
+
+  for (int row = 0; row < matrix_get_rows(); row++) {
+    for (int col = 0; col < matrix_get_width(); col++) {
+      u8 level = matrix_get_pixel(row, col);
+      if (level) {
+        len += sysfs_emit_at(buf, len, "%d,%d,%d ", col + 1, row + 1, level);
+      }
+    }
+  }
+  len += sysfs_emit_at(buf, len, "\n");
+  return len;
+}
+
+static int intensities_apply(const char *buf) {
+  int i = 0;
+  int row, col, level, charsRead;
+  while (buf[i] != '\0') {
+    if (sscanf(buf + i, "%d,%d,%d%n", &col, &row, &level, &charsRead) == 3) {
+      // we have read a col, row and intensity
+      if (matrix_check_pixel(row - 1, col - 1)) return -EINVAL;
+      if (level < 0 || level > MATRIX_MAX_INTENSITY) return -EINVAL;
+      matrix_set_intensity(row - 1, col - 1, level);
+    } else {  // read failed, didn't match format
+      return -EINVAL;
+    }
+
+    i += charsRead;               // skip over the characters we just read
+    while (isspace(buf[i])) i++;  // skip over whitespace
+  }
+
+  return 0;
+}
+
+ssize_t intensities_store(struct kobject *kobj, struct kobj_attribute *attr,
+                          const char *buf, size_t count) {
+  return store_edits(buf, count, intensities_apply);
+}
+
+ssize_t transaction_show(struct kobject *kobj, struct kobj_attribute *attr,
+                         char *buf) {
+  bool open;
+  mutex_lock(&transactionLock);
+  open = transactionOpen;
+  mutex_unlock(&transactionLock);
+  return sysfs_emit(buf, "%s\n", open ? "open" : "closed");
+}
+
+ssize_t transaction_store(struct kobject *kobj, struct kobj_attribute *attr,
+                          const char *buf, size_t count) {
+  bool begin = sysfs_streq(buf, "begin");
+  bool blank = sysfs_streq(buf, "begin blank");
+  bool commit = sysfs_streq(buf, "commit");
+  bool abort = sysfs_streq(buf, "abort");
+  int ret = 0;
+
+  mutex_lock(&transactionLock);
+  if (begin || blank) {
+    // one transaction at a time, every writer's edits go into it
+    ret = transactionOpen ? -EBUSY : matrix_begin(blank);
+    if (!ret) transactionOpen = true;
+  } else if (commit || abort) {
+    if (!transactionOpen) {
+      ret = -EINVAL;
+    } else if (commit) {
+      ret = matrix_commit();
+    } else {
+      matrix_abort();
+    }
+    if (!ret) transactionOpen = false;
+  } else {
+    ret = -EINVAL;
+  }
+  mutex_unlock(&transactionLock);
+  if (ret) return ret;
   fps = 0;
   return count;
 }
 
 ssize_t string_show(struct kobject *kobj, struct kobj_attribute *attr,
                     char *buf) {
-  return sprintf(buf, "%s\n", string);
+  ssize_t ret;
+  mutex_lock(&stringLock);
+  ret = sprintf(buf, "%s\n", string ? string : "");
+  mutex_unlock(&stringLock);
+  return ret;
 }
 
 ssize_t string_store(struct kobject *kobj, struct kobj_attribute *attr,
                      const char *buf, size_t count) {
-  // Ensure that string can fit buf;
-  if (!string) {
-    if (!kmalloc(count, GFP_KERNEL)) return -ENOMEM;
-  } else {
-    if (!krealloc(string, count, GFP_KERNEL)) return -ENOMEM;
+  int ret;
+  // a playlist message may have the frame timer at its own rate
+  bool message = playlist_get_fps();
+  char *copy = kstrdup(buf, GFP_KERNEL);
+  if (!copy) return -ENOMEM;
+  // the string attribute shows what was written, without the newline
+  copy[strcspn(copy, "\r\n")] = 0;
+
+  mutex_lock(&stringLock);
+  ret = matrix_set_string(copy);
+  if (ret) {
+    mutex_unlock(&stringLock);
+    kfree(copy);
+    return ret;
+  }
+  swap(string, copy);
+  mutex_unlock(&stringLock);
+  kfree(copy);
+
+  // If fps is currently 0, reset it to the last selected value.
+  if (!fps) {
+    fps = scrollingFps;
+    set_fps();
+  } else if (message) {
+    set_fps();
+  }
+  return count;
+}
+
+ssize_t letter_spacing_show(struct kobject *kobj, struct kobj_attribute *attr,
+                            char *buf) {
+  return sprintf(buf, "%d\n", character_get_spacing());
+}
+
+ssize_t letter_spacing_store(struct kobject *kobj, struct kobj_attribute *attr,
+                             const char *buf, size_t count) {
+  int spacing;
+  int ret = kstrtoint(buf, 10, &spacing);
+  if (ret < 0) return ret;
+  if (spacing < 0 || spacing > MAX_LETTER_SPACING) return -EINVAL;
+  // strings already on the display keep their spacing, the ticker changes
+  // straight away
+  character_set_spacing(spacing);
+  return count;
+}
+
+ssize_t font_show(struct kobject *kobj, struct kobj_attribute *attr,
+                  char *buf) {
+  return characters_print_fonts(buf);
+}
+
+ssize_t font_store(struct kobject *kobj, struct kobj_attribute *attr,
+                   const char *buf, size_t count) {
+  char name[FONT_NAME_SIZE];
+  int ret;
+  if (count >= FONT_NAME_SIZE) return -EINVAL;
+  strscpy(name, buf, sizeof(name));
+  name[strcspn(name, "\r\n")] = 0;
+  ret = characters_set_font(name, device_get());
+  return ret ? ret : count;
+}
+
+ssize_t playlist_show(struct kobject *kobj, struct kobj_attribute *attr,
+                      char *buf) {
+  return playlist_print(buf);
+}
+
+ssize_t playlist_store(struct kobject *kobj, struct kobj_attribute *attr,
+                       const char *buf, size_t count) {
+  int priority, repeat, msgFps, expiry, offset, ret;
+  if (sysfs_streq(buf, "clear")) {
+    playlist_clear();
+    return count;
   }
-  // not sure why the compiler requires the null check, but it doesn't hurt
-  if (string) strcpy(string, buf);
+  // priority repeat fps expiry text
+  if (sscanf(buf, "%d %d %d %d %n", &priority, &repeat, &msgFps, &expiry,
+             &offset) != 4) {
+    return -EINVAL;
+  }
+  ret = playlist_add(priority, repeat, msgFps, expiry, buf + offset,
+                     strcspn(buf + offset, "\r\n"));
+  if (ret) return ret;
+  return count;
+}
+
+ssize_t frame_read(struct file *file, struct kobject *kobj,
+                   struct bin_attribute *attr, char *buf, loff_t off,
+                   size_t count) {
+  int size = matrix_get_frame_size();
+  u8 *frame;
+  if (off >= size) return 0;
+  count = min_t(size_t, count, size - off);
+
+  frame = kmalloc(size, GFP_KERNEL);
+  if (!frame) return -ENOMEM;
+  matrix_get_frame(frame);
+  memcpy(buf, frame + off, count);
+  kfree(frame);
+  return count;
+}
+
+ssize_t frame_write(struct file *file, struct kobject *kobj,
+                    struct bin_attribute *attr, char *buf, loff_t off,
+                    size_t count) {
+  // only whole frames, so an image is never shown half written
+  if (off != 0 || count != matrix_get_frame_size()) return -EINVAL;
+  matrix_set_frame((const u8 *)buf);
+  fps = 0;
+  return count;
+}
 
-  matrix_set_string(buf);
+ssize_t ticker_show(struct kobject *kobj, struct kobj_attribute *attr,
+                    char *buf) {
+  return sprintf(buf, "%d\n", ticker_pending());
+}
+
+ssize_t ticker_store(struct kobject *kobj, struct kobj_attribute *attr,
+                     const char *buf, size_t count) {
+  // each write is one line of text, joined to the next by a space
+  int length = strcspn(buf, "\r\n");
+  // a playlist message may have the frame timer at its own rate
+  bool message = playlist_get_fps();
+  int queued = matrix_append_ticker(buf, length);
+  if (queued < 0) return queued;
+  if (queued < length) {
+    // the ring is full, userspace can retry the rest once it scrolls on
+    return queued ? queued : -ENOSPC;
+  }
+  matrix_append_ticker(" ", 1);
 
   // If fps is currently 0, reset it to the last selected value.
   if (!fps) {
     fps = scrollingFps;
     set_fps();
+  } else if (message) {
+    set_fps();
   }
   return count;
 }
 
+ssize_t brightness_show(struct kobject *kobj, struct kobj_attribute *attr,
+                        char *buf) {
+  return sprintf(buf, "%d\n", timer_get_brightness());
+}
+
+ssize_t brightness_store(struct kobject *kobj, struct kobj_attribute *attr,
+                         const char *buf, size_t count) {
+  int level;
+  int ret = kstrtoint(buf, 10, &level);
+  if (ret < 0) return ret;
+  if (level < 0 || level > MAX_BRIGHTNESS) return -EINVAL;
+  timer_set_brightness(level);
+  return count;
+}
+
+ssize_t sched_policy_show(struct kobject *kobj, struct kobj_attribute *attr,
+                          char *buf) {
+  int priority;
+  return sprintf(buf, "%s\n", timer_get_sched(&priority));
+}
+
+ssize_t sched_policy_store(struct kobject *kobj, struct kobj_attribute *attr,
+                           const char *buf, size_t count) {
+  int priority;
+  int policy = timer_parse_sched_policy(buf);
+  int ret;
+  if (policy < 0) return -EINVAL;
+  timer_get_sched(&priority);
+  ret = timer_set_sched(policy, priority);
+  return ret ? ret : count;
+}
+
+ssize_t sched_priority_show(struct kobject *kobj, struct kobj_attribute *attr,
+                            char *buf) {
+  int priority;
+  timer_get_sched(&priority);
+  return sprintf(buf, "%d\n", priority);
+}
+
+ssize_t sched_priority_store(struct kobject *kobj,
+                             struct kobj_attribute *attr, const char *buf,
+                             size_t count) {
+  int priority;
+  int policy = timer_parse_sched_policy(timer_get_sched(&priority));
+  int ret = kstrtoint(buf, 10, &priority);
+  if (ret < 0) return ret;
+  ret = timer_set_sched(policy, priority);
+  return ret ? ret : count;
+}
+
+ssize_t scan_cpu_show(struct kobject *kobj, struct kobj_attribute *attr,
+                      char *buf) {
+  return sprintf(buf, "%d\n", timer_get_scan_cpu());
+}
+
+ssize_t scan_cpu_store(struct kobject *kobj, struct kobj_attribute *attr,
+                       const char *buf, size_t count) {
+  int cpu;
+  int ret = kstrtoint(buf, 10, &cpu);
+  if (ret < 0) return ret;
+  if (cpu < -1) return -EINVAL;
+  ret = timer_set_scan_cpu(cpu);
+  return ret ? ret : count;
+}
+
+ssize_t scan_stats_show(struct kobject *kobj, struct kobj_attribute *attr,
+                        char *buf) {
+  struct scan_stats stats;
+  timer_get_scan_stats(&stats);
+  return sprintf(buf,
+                 "mode %s\nticks %lu\nwakeups %lu\nmissed %lu\nflips %lu\n"
+                 "deferred_flips %lu\n",
+                 timer_get_scan_mode(), stats.ticks, stats.wakeups,
+                 stats.missed, stats.flips, stats.deferredFlips);
+}
+
+ssize_t events_show(struct kobject *kobj, struct kobj_attribute *attr,
+                    char *buf) {
+  struct event_record records[EVENT_HISTORY];
+  int count = events_get(records);
+  int len = 0;
+  for (int i = 0; i < count; i++) {
+    len += sysfs_emit_at(buf, len, "%llu %s %llu\n", records[i].sequence,
+                         events_name(records[i].type), records[i].nsec);
+  }
+  return len;
+}
+
+ssize_t refresh_rate_show(struct kobject *kobj, struct kobj_attribute *attr,
+                          char *buf) {
+  unsigned long millihertz, wakeups;
+  int slots, len;
+  bool latched;
+  timer_get_refresh(&millihertz, &slots, &wakeups, &latched);
+  len = sysfs_emit(buf,
+                   "refresh %lu.%03lu Hz\nslots %d\nwakeups %lu/s\nstatic %s\n"
+                   "axis %s\n",
+                   millihertz / 1000, millihertz % 1000, slots, wakeups,
+                   latched ? "yes" : "no",
+                   matrix_scan_axis_name(matrix_get_scan_axis()));
+
+  // what the image would get scanned along either axis
+  for (enum scan_axis axis = SCAN_AXIS_COL; axis < SCAN_AXIS_AUTO; axis++) {
+    struct scan_axis_info info;
+    unsigned long duty;
+    matrix_get_scan_axis_info(axis, &info);
+    timer_get_axis_refresh(axis, &millihertz, &duty);
+    len += sysfs_emit_at(buf, len,
+                         "%s refresh %lu.%03lu Hz duty %lu.%lu%% peak %d\n",
+                         matrix_scan_axis_name(axis), millihertz / 1000,
+                         millihertz % 1000, duty / 10, duty % 10, info.peak);
+  }
+  return len;
+}
+
+ssize_t scan_axis_show(struct kobject *kobj, struct kobj_attribute *attr,
+                       char *buf) {
+  return sprintf(buf, "%s\n",
+                 matrix_scan_axis_name(matrix_get_scan_axis_setting()));
+}
+
+ssize_t scan_axis_store(struct kobject *kobj, struct kobj_attribute *attr,
+                        const char *buf, size_t count) {
+  int ret = matrix_set_scan_axis(buf);
+  return ret ? ret : count;
+}
+
 void led_matrix_exit(void) { kfree(string); }
\ No newline at end of file
@@ -1,6 +1,11 @@
+#include "characters.h"
+#include "device.h"
+#include "events.h"
+#include "latency.h"
 #include "matrix.h"
 #include "timer.h"
 #include "led-matrix-module.h"
+#include "playlist.h"
 
 #define PERMISIONS 0664  // rw-rw-r--
 
@@ -21,20 +26,85 @@ static struct kobj_attribute fps_attribute =
 // Which pixels are illuminated
 static struct kobj_attribute pixels_attribute =
     __ATTR(pixels, PERMISIONS, pixels_show, pixels_store);
+// The intensity of every lit pixel
+static struct kobj_attribute intensities_attribute =
+    __ATTR(intensities, PERMISIONS, intensities_show, intensities_store);
+// Open, commit or abort a transaction that collects edits into one image
+static struct kobj_attribute transaction_attribute =
+    __ATTR(transaction, PERMISIONS, transaction_show, transaction_store);
 // The string to display
 static struct kobj_attribute string_attribute =
     __ATTR(string, PERMISIONS, string_show, string_store);
+// The loaded fonts, and the one strings are drawn in
+static struct kobj_attribute font_attribute =
+    __ATTR(font, PERMISIONS, font_show, font_store);
+// Blank columns between two characters of a string or the ticker
+static struct kobj_attribute letter_spacing_attribute =
+    __ATTR(letter_spacing, PERMISIONS, letter_spacing_show,
+           letter_spacing_store);
+// Text to append to the scrolling ticker
+static struct kobj_attribute ticker_attribute =
+    __ATTR(ticker, PERMISIONS, ticker_show, ticker_store);
+// Messages queued to scroll one after another
+static struct kobj_attribute playlist_attribute =
+    __ATTR(playlist, PERMISIONS, playlist_show, playlist_store);
+
+// Global brightness, 0-255
+static struct kobj_attribute brightness_attribute =
+    __ATTR(brightness, PERMISIONS, brightness_show, brightness_store);
+// Scheduling policy of the scan path
+static struct kobj_attribute sched_policy_attribute =
+    __ATTR(sched_policy, PERMISIONS, sched_policy_show, sched_policy_store);
+// SCHED_FIFO priority of the scan path
+static struct kobj_attribute sched_priority_attribute = __ATTR(
+    sched_priority, PERMISIONS, sched_priority_show, sched_priority_store);
+// The cpu the scan path runs on
+static struct kobj_attribute scan_cpu_attribute =
+    __ATTR(scan_cpu, PERMISIONS, scan_cpu_show, scan_cpu_store);
+// Which lines are multiplexed
+static struct kobj_attribute scan_axis_attribute =
+    __ATTR(scan_axis, PERMISIONS, scan_axis_show, scan_axis_store);
+// How the scanlines are driven (read only)
+static struct kobj_attribute scan_stats_attribute =
+    __ATTR(scan_stats, 0444, scan_stats_show, NULL);
+// The effective refresh rate of the current image (read only)
+static struct kobj_attribute refresh_rate_attribute =
+    __ATTR(refresh_rate, 0444, refresh_rate_show, NULL);
+// The latest events, for poll() to wait on (read only)
+static struct kobj_attribute events_attribute =
+    __ATTR(events, 0444, events_show, NULL);
 
 static struct attribute *attrs[] = {&rows_attribute.attr,
                                     &col_attribute.attr,
                                     &character_attribute.attr,
                                     &fps_attribute.attr,
                                     &pixels_attribute.attr,
+                                    &intensities_attribute.attr,
+                                    &transaction_attribute.attr,
                                     &string_attribute.attr,
+                                    &font_attribute.attr,
+                                    &letter_spacing_attribute.attr,
+                                    &ticker_attribute.attr,
+                                    &playlist_attribute.attr,
+                                    &brightness_attribute.attr,
+                                    &sched_policy_attribute.attr,
+                                    &sched_priority_attribute.attr,
+                                    &scan_cpu_attribute.attr,
+                                    &scan_axis_attribute.attr,
+                                    &scan_stats_attribute.attr,
+                                    &refresh_rate_attribute.attr,
+                                    &events_attribute.attr,
                                     NULL};
 
+// The whole framebuffer as a packed bitmap, sized once the geometry is known
+static struct bin_attribute frame_attribute =
+    __BIN_ATTR(frame, PERMISIONS, frame_read, frame_write, 0);
+
+static struct bin_attribute *bin_attrs[] = {&frame_attribute, NULL};
+
 static struct attribute_group attr_group = {
     .attrs = attrs,
+    .bin_attrs = bin_attrs,
 };
 
 static struct kobject *led_matrix;
@@ -47,21 +117,37 @@ static int __init led_module_init(void) {
   led_matrix = kobject_create_and_add("led-matrix", NULL);
   if (!led_matrix) return -ENOMEM;
 
-  // Create the files associated with this kobject
+  characters_init();
+  ret = matrix_init();
+  if (ret) {
+    kobject_put(led_matrix);
+    return ret;
+  }
+  matrix_display_clear();
+
+  // Create the files associated with this kobject, once the matrix they
+  // control exists
+  frame_attribute.size = matrix_get_frame_size();
   ret = sysfs_create_group(led_matrix, &attr_group);
   if (ret) {
+    matrix_free();
     kobject_put(led_matrix);
     return ret;
   }
   printk(KERN_INFO "Kobject created\n");
-
-  ret = matrix_init();
+  events_init(led_matrix);
+  latency_init();
+  ret = timer_init();
   if (ret) {
+    latency_exit();
+    events_exit();
+    matrix_free();
     kobject_put(led_matrix);
     return ret;
   }
-  matrix_display_clear();
-  timer_init();
+
+  // the device is optional, sysfs keeps working without it
+  if (device_init()) printk(KERN_ALERT "Could not register /dev/ledmatrix\n");
 
   matrix_set_character('A');
 
@@ -70,10 +156,16 @@ static int __init led_module_init(void) {
 }
 
 static void __exit led_module_exit(void) {
+  events_exit();
   kobject_put(led_matrix);
   printk(KERN_INFO "Kobject removed\n");
-  matrix_free();
+  // the timers may still be driving the pins, stop them before freeing
   timer_exit();
+  device_exit();
+  playlist_exit();
+  characters_exit();
+  latency_exit();
+  matrix_free();
   led_matrix_exit();
 }
 
@@ -32,6 +32,20 @@ ssize_t pixels_show(struct kobject *kobj, struct kobj_attribute *attr,
 ssize_t pixels_store(struct kobject *kobj, struct kobj_attribute *attr,
                      const char *buf, size_t count);
 
+// The intensity of every lit pixel
+ssize_t intensities_show(struct kobject *kobj, struct kobj_attribute *attr,
+                         char *buf);
+
+ssize_t intensities_store(struct kobject *kobj, struct kobj_attribute *attr,
+                          const char *buf, size_t count);
+
+// Groups row, column and pixel edits: begin (or begin blank), commit, abort
+ssize_t transaction_show(struct kobject *kobj, struct kobj_attribute *attr,
+                         char *buf);
+
+ssize_t transaction_store(struct kobject *kobj, struct kobj_attribute *attr,
+                          const char *buf, size_t count);
+
 // The string to display
 ssize_t string_show(struct kobject *kobj, struct kobj_attribute *attr,
                     char *buf);
@@ -39,5 +53,90 @@ ssize_t string_show(struct kobject *kobj, struct kobj_attribute *attr,
 ssize_t string_store(struct kobject *kobj, struct kobj_attribute *attr,
                      const char *buf, size_t count);
 
+// Queued messages: "priority repeat fps expiry text" per write, or "clear"
+ssize_t playlist_show(struct kobject *kobj, struct kobj_attribute *attr,
+                      char *buf);
+
+ssize_t playlist_store(struct kobject *kobj, struct kobj_attribute *attr,
+                       const char *buf, size_t count);
+
+// The whole framebuffer as a packed bitmap (binary)
+ssize_t frame_read(struct file *file, struct kobject *kobj,
+                   struct bin_attribute *attr, char *buf, loff_t off,
+                   size_t count);
+
+ssize_t frame_write(struct file *file, struct kobject *kobj,
+                    struct bin_attribute *attr, char *buf, loff_t off,
+                    size_t count);
+
+// The font in use and every other one loaded, write a name to switch
+ssize_t font_show(struct kobject *kobj, struct kobj_attribute *attr,
+                  char *buf);
+
+ssize_t font_store(struct kobject *kobj, struct kobj_attribute *attr,
+                   const char *buf, size_t count);
+
+// Blank glyph columns between the characters of strings and the ticker
+ssize_t letter_spacing_show(struct kobject *kobj, struct kobj_attribute *attr,
+                            char *buf);
+
+ssize_t letter_spacing_store(struct kobject *kobj, struct kobj_attribute *attr,
+                             const char *buf, size_t count);
+
+// Text appended to the scrolling ticker, and how much has not scrolled on yet
+ssize_t ticker_show(struct kobject *kobj, struct kobj_attribute *attr,
+                    char *buf);
+
+ssize_t ticker_store(struct kobject *kobj, struct kobj_attribute *attr,
+                     const char *buf, size_t count);
+
+// Global brightness, 0-255
+ssize_t brightness_show(struct kobject *kobj, struct kobj_attribute *attr,
+                        char *buf);
+
+ssize_t brightness_store(struct kobject *kobj, struct kobj_attribute *attr,
+                         const char *buf, size_t count);
+
+// Scheduling policy of the scan path: other, fifo or deadline
+ssize_t sched_policy_show(struct kobject *kobj, struct kobj_attribute *attr,
+                          char *buf);
+
+ssize_t sched_policy_store(struct kobject *kobj, struct kobj_attribute *attr,
+                           const char *buf, size_t count);
+
+// SCHED_FIFO priority of the scan path
+ssize_t sched_priority_show(struct kobject *kobj, struct kobj_attribute *attr,
+                            char *buf);
+
+ssize_t sched_priority_store(struct kobject *kobj,
+                             struct kobj_attribute *attr, const char *buf,
+                             size_t count);
+
+// The cpu the scan path is pinned to, -1 for any
+ssize_t scan_cpu_show(struct kobject *kobj, struct kobj_attribute *attr,
+                      char *buf);
+
+ssize_t scan_cpu_store(struct kobject *kobj, struct kobj_attribute *attr,
+                       const char *buf, size_t count);
+
+// How the scanlines are driven, and how often that woke a thread
+ssize_t scan_stats_show(struct kobject *kobj, struct kobj_attribute *attr,
+                        char *buf);
+
+// Which lines are multiplexed: col, row or auto
+ssize_t scan_axis_show(struct kobject *kobj, struct kobj_attribute *attr,
+                       char *buf);
+
+ssize_t scan_axis_store(struct kobject *kobj, struct kobj_attribute *attr,
+                        const char *buf, size_t count);
+
+// The effective refresh rate after skipping blank columns
+ssize_t refresh_rate_show(struct kobject *kobj, struct kobj_attribute *attr,
+                          char *buf);
+
+// The latest scroll wrap, animation end and commit events, pollable
+ssize_t events_show(struct kobject *kobj, struct kobj_attribute *attr,
+                    char *buf);
+
 // Frees module memory
 void led_matrix_exit(void);
\ No newline at end of file
@@ -1,10 +1,21 @@
 #include "matrix.h"
 
 #include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/atomic.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/overflow.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
 #include <linux/string.h>
 #include <stdbool.h>
 
 #include "characters.h"
+#include "events.h"
+#include "playlist.h"
+#include "ticker.h"
+#include "timer.h"
 
 // GPIO pin numbers
 #define COL_ONE 5
@@ -21,20 +32,464 @@
 #define ROW_SIX 27
 #define ROW_SEVEN 22
 
-static int cols[] = {COL_ONE, COL_TWO, COL_THREE, COL_FOUR, COL_FIVE};
-static int rows[] = {ROW_ONE,  ROW_TWO, ROW_THREE, ROW_FOUR,
-                     ROW_FIVE, ROW_SIX, ROW_SEVEN};
+static int cols[MAX_PANELS * MAX_COLS] = {COL_ONE, COL_TWO, COL_THREE,
+                                          COL_FOUR, COL_FIVE};
+static int rows[MAX_PANELS * MAX_ROWS] = {ROW_ONE,  ROW_TWO, ROW_THREE, ROW_FOUR,
+                                          ROW_FIVE, ROW_SIX, ROW_SEVEN};
+static unsigned int colPinCount = DEFAULT_COLS;
+static unsigned int rowPinCount = DEFAULT_ROWS;
 
-// Stored as an array of rows that each hold an entire column. Cols grow when
-// scrolling through text.
-static char** matrixBuffer = NULL;
+// The pins can be moved at load time, e.g. onto a gpio-sim chip for testing
+module_param_array_named(col_pins, cols, int, &colPinCount, 0444);
+MODULE_PARM_DESC(col_pins,
+                 "GPIO numbers of the column lines of every panel, left to "
+                 "right");
+module_param_array_named(row_pins, rows, int, &rowPinCount, 0444);
+MODULE_PARM_DESC(row_pins,
+                 "GPIO numbers of the row lines, shared by all panels, or "
+                 "of every panel in turn");
 
-// The index of the first column of the image that is currently being displayed
-static int matrixBufferLocation = 0;
-// The length of the image currently in the buffer
-static int matrixBufferLength = 0;
-// current scrolling state
-static bool isMatrixScrolling = false;
+// Geometry of one panel
+static int panelRows = DEFAULT_ROWS;
+module_param_named(panel_rows, panelRows, int, 0444);
+MODULE_PARM_DESC(panel_rows, "Rows of one panel (1-32, default 7)");
+static int panelCols = DEFAULT_COLS;
+module_param_named(panel_cols, panelCols, int, 0444);
+MODULE_PARM_DESC(panel_cols, "Columns of one panel (1-32, default 5)");
+
+static int panels = 1;
+module_param(panels, int, 0444);
+MODULE_PARM_DESC(panels,
+                 "Number of panels chained side by side into one display "
+                 "(1-8, default 1)");
+
+static int grayscale_bits = 4;
+module_param(grayscale_bits, int, 0444);
+MODULE_PARM_DESC(grayscale_bits,
+                 "Bit planes per pixel intensity (1-8, default 4). Images "
+                 "that are only fully on or off always use one plane.");
+
+static bool gpio_batch = true;
+module_param(gpio_batch, bool, 0444);
+MODULE_PARM_DESC(gpio_batch,
+                 "Write a whole scanline with one gpiod array call (default) "
+                 "instead of one gpio_set_value per pin");
+
+// Every pin as one bitmap, row lines first then column lines, so a whole
+// scanline can be handed to gpiolib at once. PIN_COUNT is enough for the
+// largest display, pinCount are in use.
+#define PIN_COUNT (MAX_PANELS * (MAX_ROWS + MAX_COLS))
+#define ROW_PIN(line) (line)
+#define COL_PIN(col) (rowPinCount + (col))
+static struct gpio_desc *pinDescs[PIN_COUNT];
+static int pinCount = DEFAULT_ROWS + DEFAULT_COLS;
+// Set when a pin is on a chip that sleeps (i2c or spi expanders, gpio-sim).
+// Those are only ever written from the scan threads or worker, never in irq
+// mode, and need the _cansleep accessors there.
+static bool pinsCanSleep = false;
+
+// Columns of the whole display
+static int width = DEFAULT_COLS;
+// When every panel has its own row lines, scan position p drives column p of
+// all panels at once, so adding panels does not lower the refresh rate. With
+// shared row lines only one column of the display can be lit at a time and
+// every column is its own scan position. Scanning rows, position r always
+// drives row r of every panel.
+static bool sharedRows = true;
+static int colPositions = DEFAULT_COLS;
+// The most scan positions of either axis, the size of the scan programs
+static int maxPositions = DEFAULT_ROWS;
+// Bytes an image stores each column word in, the smallest of u8, u16 and u32
+// holding every row, so a 5x7 panel costs a byte per column and plane
+static int imageWordSize = sizeof(u8);
+
+static const char* const scanAxisNames[] = {
+    [SCAN_AXIS_COL] = "col",
+    [SCAN_AXIS_ROW] = "row",
+    [SCAN_AXIS_AUTO] = "auto",
+};
+static enum scan_axis scanAxis = SCAN_AXIS_AUTO;
+static char* scan_axis = "auto";
+module_param(scan_axis, charp, 0444);
+MODULE_PARM_DESC(scan_axis,
+                 "Multiplex the columns (col), the rows (row) or whichever "
+                 "gives the image the higher duty cycle (auto, default)");
+// Whether the timer scans blank positions too, which changes the duty cycle
+// auto compares
+static bool scanAllPositions = false;
+
+// The row line that lights row `row` of display column `col`
+static inline int row_line(int col, int row) {
+  return sharedRows ? row : (col / panelCols) * panelRows + row;
+}
+
+// The row lines of the panel holding display column `col`, or all of them
+static inline int row_group(int col) {
+  return sharedRows ? 0 : col / panelCols;
+}
+
+struct scan_frames;
+
+// The scan program: the complete pin state for every scan slot (column) and
+// bit plane, compiled from the framebuffer whenever the image or scroll
+// position changes so the timer only has to replay the next entry. Its
+// arrays are sized for the geometry when the module loads.
+struct scan_program {
+  // Plane p holds bit (8 - planes + p) of each pixel's intensity and is shown
+  // for 2^p / (2^planes - 1) of the column's dwell time (binary code
+  // modulation), so a frame costs one timer event per plane instead of one
+  // per intensity level. Indexed with program_pins, planeStride planes per
+  // position.
+  unsigned long* pins;
+  int planeCount;
+  int planeStride;
+  // The scan positions that have something lit, in scan order
+  int* slots;
+  int slotCount;
+  // The axis being scanned, the scan positions along it, and what scanning
+  // either axis would take
+  enum scan_axis axis;
+  int positions;
+  struct scan_axis_info axes[SCAN_AXIS_AUTO];
+  // Set when every lit column shows the same rows at full intensity (fully
+  // lit rows, fully lit columns or a blank image). Then all of those columns
+  // can be driven at once and the pins never have to change.
+  bool isStatic;
+  unsigned long* staticPins;
+  // An animation is compiled into one program per frame when it is uploaded,
+  // and this program only carries them. The scan path shows whichever frame
+  // the frame timer last picked, so a new frame needs no compile.
+  struct scan_frames* frames;
+};
+
+// The programs of every frame of an animation, one allocation freed after an
+// rcu grace period since the scan path may still be showing one
+struct scan_frames {
+  struct rcu_head rcu;
+  u16 animation;  // id of the animation they were compiled from
+  int count;
+  struct scan_program programs[];
+};
+
+// The animation and frame the frame timer is on, animation id in the upper
+// half, so a step of an animation that has just been replaced never picks a
+// frame of the new one
+static atomic_t animationFrame = ATOMIC_INIT(0);
+static atomic_t animationIds = ATOMIC_INIT(0);
+// The frame of the front program's animation the scan path shows
+static int scanFrame = 0;
+
+// Triple buffered so an image only ever changes between two scan cycles: the
+// scan path shows scanPrograms[scanFront], matrix_compile writes into
+// scanPrograms[scanBack] and hands it over through scanPending, flagged with
+// PROGRAM_FRESH until matrix_flip picks it up. Neither side ever waits.
+#define PROGRAM_FRESH 4
+static struct scan_program scanPrograms[3] = {
+    [0 ... 2] = {.planeCount = 1, .positions = DEFAULT_COLS},
+};
+static int scanFront = 0;                         // owned by the scan path
+static int scanBack = 1;                          // owned by matrix_compile
+static atomic_t scanPending = ATOMIC_INIT(2);
+static DEFINE_MUTEX(compileLock);                 // one compile at a time
+
+// The pin bitmap of one scan position and bit plane
+static inline unsigned long* program_pins(struct scan_program* program,
+                                          int pos, int plane) {
+  return &program->pins[(pos * program->planeStride + plane) *
+                        BITS_TO_LONGS(pinCount)];
+}
+
+static void scan_programs_free(void) {
+  for (int i = 0; i < ARRAY_SIZE(scanPrograms); i++) {
+    kvfree(scanPrograms[i].pins);
+    kfree(scanPrograms[i].slots);
+    kfree(scanPrograms[i].staticPins);
+    // the timers are stopped, nothing is showing them anymore
+    kvfree(scanPrograms[i].frames);
+    scanPrograms[i].frames = NULL;
+    scanPrograms[i].pins = NULL;
+    scanPrograms[i].slots = NULL;
+    scanPrograms[i].staticPins = NULL;
+  }
+}
+
+static int scan_programs_alloc(void) {
+  int pinLongs = BITS_TO_LONGS(pinCount);
+  for (int i = 0; i < ARRAY_SIZE(scanPrograms); i++) {
+    struct scan_program* program = &scanPrograms[i];
+    program->pins = kvcalloc(maxPositions * grayscale_bits * pinLongs,
+                             sizeof(unsigned long), GFP_KERNEL);
+    program->slots = kcalloc(maxPositions, sizeof(int), GFP_KERNEL);
+    program->staticPins = kcalloc(pinLongs, sizeof(unsigned long), GFP_KERNEL);
+    program->planeStride = grayscale_bits;
+    if (!program->pins || !program->slots || !program->staticPins) {
+      scan_programs_free();
+      return -ENOMEM;
+    }
+  }
+  return 0;
+}
+
+// Scratch space for matrix_compile, too large for the stack, under compileLock
+static matrix_col_t compileVisible[MAX_WIDTH][MAX_GRAYSCALE_BITS];
+static matrix_col_t compileRowMasks[MAX_WIDTH];
+
+// An image: one contiguous, column-major array holding a bitmask of the lit
+// rows for every column and bit plane, word col * planes + plane, each word
+// imageWordSize bytes (read and written with image_get and image_put). Plane
+// p holds bit (8 - planes + p) of each pixel's intensity, so a plain on/off
+// image such as a scrolling string needs one word per column. The planes only
+// grow to grayscale_bits once a pixel is set partly lit.
+struct matrix_image {
+  struct rcu_head rcu;
+  int length;  // columns in the image
+  int planes;
+  bool scrolling;
+  // A playlist message hands over to the next one when it wraps around
+  bool message;
+  // A ticker image has no columns of its own, they are the ticker's ring of
+  // display columns, which the frame path scrolls outside the image
+  bool ticker;
+  // Playback state, the only fields changed once the image is published, and
+  // only by the frame path (the frame timer and the frame thread or work).
+  // Readers load location with READ_ONCE.
+  // The index of the first column of the image being displayed, a new image
+  // always starts at 0.
+  int location;
+  // An animation is `frames` display wide images back to back, and location
+  // jumps from one to the next when the frame timer expires. Their durations
+  // in microseconds are stored after the columns (padded to a u32), in the
+  // same allocation.
+  int frames;
+  u16 animation;  // id matching the scan programs of its frames
+  int loops;  // plays left including this one, 0 for ever (playback state)
+  bool ended;  // the last play is over (playback state)
+  const u32* durations;
+  // A staging image of a nested transaction keeps the one it was copied
+  // from, put back if the nested transaction is aborted
+  struct matrix_image* saved;
+  u8 cols[];
+};
+
+// The framebuffer is never modified in place, apart from the playback state
+// the frame path moves along (see struct matrix_image). Writers, serialized by
+// writeLock, build a new image and publish it with rcu_assign_pointer, and the
+// old one is freed after a grace period. Readers (the frame path, sysfs shows)
+// only take rcu_read_lock and never block a writer or wait on one. The scan
+// path does not read the framebuffer at all, only the compiled scan program.
+static struct matrix_image __rcu* matrixImage = NULL;
+static DEFINE_MUTEX(writeLock);
+// While a transaction is open, edits collect in the staging image and only
+// the outermost matrix_commit publishes it. Both are guarded by writeLock.
+static struct matrix_image* staging = NULL;
+static int stagingDepth = 0;
+// What the first playlist message replaced, put back by matrix_resume when
+// the playlist runs out. It is no longer published, and anything else
+// published in the meantime drops it. Guarded by writeLock.
+static struct matrix_image* pausedImage = NULL;
+
+// Free a staging image and every one saved under it
+static void staging_free(struct matrix_image* image) {
+  while (image) {
+    struct matrix_image* saved = image->saved;
+    kvfree(image);
+    image = saved;
+  }
+}
+
+// Make `image` the staging image in place of the current one, which has not
+// been published, so nobody else can be reading it
+static void staging_replace(struct matrix_image* image) {
+  image->saved = staging->saved;
+  kvfree(staging);
+  staging = image;
+}
+
+static void matrix_compile(void);
+static struct scan_frames* frames_compile(const struct matrix_image* image);
+static void frames_publish(struct scan_frames* frames);
+
+// Bytes taken by the columns of an image, up to what is stored after them
+static size_t image_cols_size(int length, int planes) {
+  return ALIGN(length * planes * imageWordSize, sizeof(u32));
+}
+
+// A blank image of `length` columns and `planes` planes, followed by `tail`
+// more bytes
+static struct matrix_image* image_alloc_tail(int length, int planes,
+                                             size_t tail) {
+  struct matrix_image* image = kvzalloc(
+      struct_size(image, cols, image_cols_size(length, planes) + tail),
+      GFP_KERNEL);
+  if (!image) return NULL;
+  image->length = length;
+  image->planes = planes;
+  return image;
+}
+
+// A blank image of `length` columns and `planes` planes
+static struct matrix_image* image_alloc(int length, int planes) {
+  return image_alloc_tail(length, planes, 0);
+}
+
+// The image writers start from, callers hold writeLock
+static struct matrix_image* image_current(void) {
+  return rcu_dereference_protected(matrixImage, lockdep_is_held(&writeLock));
+}
+
+// Make `image` the framebuffer, compile it and free the previous one once no
+// reader can see it anymore. Callers hold writeLock.
+static void image_publish(struct matrix_image* image) {
+  struct matrix_image* old = image_current();
+  rcu_assign_pointer(matrixImage, image);
+  matrix_compile();
+  events_raise(MATRIX_EVENT_COMMIT);
+  if (image->message) {
+    // a message keeps what it interrupts to be resumed
+    if (old && !old->message) {
+      pausedImage = old;
+      old = NULL;
+    }
+  } else if (pausedImage) {
+    // something new is shown in place of the playlist, nothing to resume
+    kvfree_rcu(pausedImage, rcu);
+    pausedImage = NULL;
+  }
+  // long strings and animations may have been vmalloc'ed
+  if (old) kvfree_rcu(old, rcu);
+}
+
+// One plane of one column of an image. A ticker image has none, its columns
+// are read with ticker_get_col.
+static inline matrix_col_t image_get(const struct matrix_image* image, int col,
+                                     int plane) {
+  int word = col * image->planes + plane;
+  WARN_ON_ONCE(image->ticker);
+  switch (imageWordSize) {
+    case sizeof(u8):
+      return image->cols[word];
+    case sizeof(u16):
+      return ((const u16*)image->cols)[word];
+    default:
+      return ((const u32*)image->cols)[word];
+  }
+}
+
+static inline void image_put(struct matrix_image* image, int col, int plane,
+                             matrix_col_t mask) {
+  int word = col * image->planes + plane;
+  WARN_ON_ONCE(image->ticker);
+  switch (imageWordSize) {
+    case sizeof(u8):
+      image->cols[word] = mask;
+      break;
+    case sizeof(u16):
+      ((u16*)image->cols)[word] = mask;
+      break;
+    default:
+      ((u32*)image->cols)[word] = mask;
+  }
+}
+
+// The column of an image on display column `col`: an animation shows the
+// frame the frame path has moved to, as the scan program does
+static int image_shown_col(const struct matrix_image* image, int col) {
+  return image->frames ? READ_ONCE(image->location) + col : col;
+}
+
+// All lit rows of a column as it is shown, whatever their intensity
+static matrix_col_t image_col_lit(const struct matrix_image* image, int col) {
+  matrix_col_t lit = 0;
+  if (image->ticker) return ticker_get_col(col);
+  col = image_shown_col(image, col);
+  for (int p = 0; p < image->planes; p++) lit |= image_get(image, col, p);
+  return lit;
+}
+
+// Light every row in `mask` of a column at full intensity, clear the others
+static void image_fill_col(struct matrix_image* image, int col,
+                           matrix_col_t mask) {
+  for (int p = 0; p < image->planes; p++) image_put(image, col, p, mask);
+}
+
+static void image_set_pixel(struct matrix_image* image, int row, int col,
+                            u8 level) {
+  for (int p = 0; p < image->planes; p++) {
+    int bit = BITS_PER_BYTE - image->planes + p;
+    matrix_col_t mask = image_get(image, col, p);
+    if (level & BIT(bit)) {
+      mask |= BIT(row);
+    } else {
+      mask &= ~BIT(row);
+    }
+    image_put(image, col, p, mask);
+  }
+}
+
+// The intensity of a pixel as it is shown
+static u8 image_get_pixel(const struct matrix_image* image, int row, int col) {
+  int value = 0;
+  // a ticker is plain on/off
+  if (image->ticker) {
+    return ticker_get_col(col) & BIT(row) ? MATRIX_MAX_INTENSITY : 0;
+  }
+  col = image_shown_col(image, col);
+  for (int p = 0; p < image->planes; p++) {
+    if (image_get(image, col, p) & BIT(row)) value |= BIT(p);
+  }
+  // spread the stored bits back over the whole intensity range
+  return value * MATRIX_MAX_INTENSITY / (BIT(image->planes) - 1);
+}
+
+// A static (display wide) copy of `current` to edit, with at least `planes`
+// planes. Anything lit keeps its intensity.
+static struct matrix_image* image_copy(const struct matrix_image* current,
+                                       int planes) {
+  struct matrix_image* image;
+  int location = READ_ONCE(current->location);
+  planes = max(planes, current->planes);
+  image = image_alloc(width, planes);
+  if (!image) return NULL;
+  for (int col = 0; col < width; col++) {
+    // an animation is edited as it is on the display
+    int fromCol = current->frames ? location + col : col;
+    int added = planes - current->planes;
+    matrix_col_t full = matrix_col_mask();
+    // and so is a ticker, from its ring of columns
+    if (current->ticker) {
+      image_fill_col(image, col, ticker_get_col(col));
+      continue;
+    }
+    // a plane keeps its bit of the intensity, the new low planes are 0
+    for (int p = 0; p < current->planes; p++) {
+      matrix_col_t mask = image_get(current, fromCol, p);
+      image_put(image, col, added + p, mask);
+      full &= mask;
+    }
+    // but a full intensity pixel stays fully lit
+    for (int p = 0; p < added; p++) image_put(image, col, p, full);
+  }
+  return image;
+}
+
+// The image an edit is made to: the staging image of an open transaction,
+// with at least `planes` planes, or else a copy of the current image. Callers
+// hold writeLock.
+static struct matrix_image* image_edit(int planes) {
+  struct matrix_image* image;
+  if (!staging) return image_copy(image_current(), planes);
+  if (staging->planes >= planes) return staging;
+  image = image_copy(staging, planes);
+  if (!image) return NULL;
+  staging_replace(image);
+  return staging;
+}
+
+// Show an edited image, unless it is staged for a transaction. Callers hold
+// writeLock.
+static void image_edit_done(struct matrix_image* image) {
+  if (image != staging) image_publish(image);
+}
 
 static int gpio_init(int pin) {
   // Check that the GPIO pins are valid
@@ -50,65 +505,137 @@ static int gpio_init(int pin) {
   // Set the GPIO pins to output
   if (gpio_direction_output(pin, 0)) {
     printk(KERN_INFO "Failed to set GPIO direction %d\n", pin);
+    gpio_free(pin);
     return -ENODEV;
-  } else {  // initialize pins to off
-    gpio_set_value(pin, 0);
+  } else {  // initialize pins to off, from process context so any chip will do
+    gpio_set_value_cansleep(pin, 0);
   }
   return 0;
 }
 
 int matrix_init(void) {
+  struct matrix_image* image;
+  int colsReady = 0, rowsReady = 0;
   int ret;
-  for (int i = 0; i < COLS; i++) {
-    ret = gpio_init(cols[i]);
-    if (ret) return ret;
+  if (grayscale_bits < 1 || grayscale_bits > MAX_GRAYSCALE_BITS) {
+    printk(KERN_INFO "Invalid grayscale_bits: %d\n", grayscale_bits);
+    return -EINVAL;
+  }
+  if (panelRows < 1 || panelRows > MAX_ROWS || panelCols < 1 ||
+      panelCols > MAX_COLS) {
+    printk(KERN_INFO "Invalid panel size: %dx%d\n", panelCols, panelRows);
+    return -EINVAL;
+  }
+  if (panels < 1 || panels > MAX_PANELS || colPinCount != panels * panelCols) {
+    printk(KERN_INFO "Need %d col_pins for %d panels\n", panels * panelCols,
+           panels);
+    return -EINVAL;
+  }
+  if (rowPinCount != panelRows && rowPinCount != panels * panelRows) {
+    printk(KERN_INFO "Need %d shared or %d row_pins\n", panelRows,
+           panels * panelRows);
+    return -EINVAL;
+  }
+  width = panels * panelCols;
+  imageWordSize = panelRows <= 8 ? sizeof(u8)
+                  : panelRows <= 16 ? sizeof(u16)
+                                    : sizeof(u32);
+  sharedRows = rowPinCount == panelRows;
+  colPositions = sharedRows ? width : panelCols;
+  maxPositions = max(colPositions, panelRows);
+  ret = sysfs_match_string(scanAxisNames, scan_axis);
+  if (ret < 0) {
+    printk(KERN_INFO "Unknown scan_axis %s\n", scan_axis);
+    return -EINVAL;
+  }
+  scanAxis = ret;
+  pinCount = rowPinCount + colPinCount;
+
+  for (; colsReady < colPinCount; colsReady++) {
+    ret = gpio_init(cols[colsReady]);
+    if (ret) goto free_pins;
+  }
+  for (; rowsReady < rowPinCount; rowsReady++) {
+    ret = gpio_init(rows[rowsReady]);
+    if (ret) goto free_pins;
   }
-  for (int i = 0; i < ROWS; i++) {
-    ret = gpio_init(rows[i]);
-    if (ret) return ret;
+  for (int i = 0; i < rowPinCount; i++) {
+    pinDescs[ROW_PIN(i)] = gpio_to_desc(rows[i]);
   }
+  for (int i = 0; i < colPinCount; i++) {
+    pinDescs[COL_PIN(i)] = gpio_to_desc(cols[i]);
+  }
+  pinsCanSleep = matrix_gpio_can_sleep();
   printk(KERN_INFO "GPIO initialized\n");
 
-  // Framebuffer stored as an array of rows that each hold an entire column of
-  // the image. Cols are lengthened when scrolling over characters of a string.
+  ret = scan_programs_alloc();
+  if (ret) goto free_pins;
+
+  // Framebuffer columns are added when scrolling over characters of a string.
   // Zero allocated
-  matrixBuffer = kzalloc(ROWS * sizeof(char*), GFP_KERNEL);
-  for (int i = 0; i < ROWS; i++) {
-    matrixBuffer[i] = kzalloc(COLS * sizeof(char), GFP_KERNEL);
+  image = image_alloc(width, 1);
+  if (!image) {
+    ret = -ENOMEM;
+    goto free_programs;
   }
-  matrixBufferLength = COLS;
+  mutex_lock(&writeLock);
+  image_publish(image);
+  mutex_unlock(&writeLock);
   return 0;
+
+free_programs:
+  scan_programs_free();
+free_pins:
+  // only the pins requested so far
+  while (rowsReady--) gpio_free(rows[rowsReady]);
+  while (colsReady--) gpio_free(cols[colsReady]);
+  return ret;
 }
 
+// The timers and sysfs files are gone by now, so there are no readers left
 void free_matrix_buffer(void) {
-  if (matrixBuffer != NULL) {
-    for (int i = 0; i < ROWS; i++) {
-      kfree(matrixBuffer[i]);
-    }
-    kfree(matrixBuffer);
-    matrixBuffer = NULL;
-  }
+  mutex_lock(&writeLock);
+  kvfree(image_current());
+  RCU_INIT_POINTER(matrixImage, NULL);
+  kvfree(pausedImage);
+  pausedImage = NULL;
+  // a transaction left open is never shown
+  staging_free(staging);
+  staging = NULL;
+  stagingDepth = 0;
+  mutex_unlock(&writeLock);
 }
 
 int matrix_free(void) {
   matrix_display_clear();
-  for (int i = 0; i < COLS; i++) {
+  for (int i = 0; i < colPinCount; i++) {
     gpio_free(cols[i]);
   }
 
-  for (int i = 0; i < ROWS; i++) {
+  for (int i = 0; i < rowPinCount; i++) {
     gpio_free(rows[i]);
   }
 
   free_matrix_buffer();
+  scan_programs_free();
   printk(KERN_INFO "GPIO cleaned up\n");
   return 0;
 }
 
+bool matrix_gpio_can_sleep(void) {
+  for (int i = 0; i < colPinCount; i++) {
+    if (gpio_cansleep(cols[i])) return true;
+  }
+  for (int i = 0; i < rowPinCount; i++) {
+    if (gpio_cansleep(rows[i])) return true;
+  }
+  return false;
+}
+
 //bounds checks
 
 int matrix_check_col(int col) {
-  if (col < 0 || col >= COLS) {
+  if (col < 0 || col >= width) {
     printk(KERN_INFO "Invalid col: %d\n", col);
     return EINVAL;
   }
@@ -116,7 +643,7 @@ int matrix_check_col(int col) {
 }
 
 int matrix_check_row(int row) {
-  if (row < 0 || row >= ROWS) {
+  if (row < 0 || row >= panelRows) {
     printk(KERN_INFO "Invalid row: %d\n", row);
     return EINVAL;
   }
@@ -131,132 +658,867 @@ int matrix_check_pixel(int row, int col) {
 
 // sets the "framebuffer" to all 0s
 void matrix_set_clear(void) {
-  for (int i = 0; i < ROWS; i++) {
-    memset(matrixBuffer[i], 0, matrixBufferLength * sizeof(char));
+  struct matrix_image* image = image_alloc(width, 1);
+  if (!image) return;
+  mutex_lock(&writeLock);
+  if (staging) {
+    staging_replace(image);
+  } else {
+    image_publish(image);
   }
-  matrixBufferLocation = 0;
-  matrixBufferLength = COLS;
-  isMatrixScrolling = false;
+  mutex_unlock(&writeLock);
 }
 
-static void disable_scrolling(void) {
-  matrixBufferLocation = 0;
-  matrixBufferLength = COLS;
-  isMatrixScrolling = false;
+int matrix_begin(bool blank) {
+  struct matrix_image* image;
+  mutex_lock(&writeLock);
+  // a nested transaction carries on from the staged edits, on a copy so they
+  // can be put back when it is aborted
+  if (blank) {
+    image = image_alloc(width, 1);
+  } else {
+    image = image_copy(staging ? staging : image_current(), 1);
+  }
+  if (!image) {
+    mutex_unlock(&writeLock);
+    return -ENOMEM;
+  }
+  image->saved = staging;
+  staging = image;
+  stagingDepth++;
+  mutex_unlock(&writeLock);
+  return 0;
+}
+
+int matrix_commit(void) {
+  mutex_lock(&writeLock);
+  if (!stagingDepth) {
+    mutex_unlock(&writeLock);
+    return -EINVAL;
+  }
+  if (!--stagingDepth) {
+    image_publish(staging);
+    staging = NULL;
+  } else {
+    // the outer transaction takes the edits, what they replaced is gone
+    struct matrix_image* saved = staging->saved;
+    staging->saved = saved->saved;
+    kvfree(saved);
+  }
+  mutex_unlock(&writeLock);
+  return 0;
+}
+
+void matrix_abort(void) {
+  struct matrix_image* saved;
+  mutex_lock(&writeLock);
+  if (stagingDepth) {
+    stagingDepth--;
+    saved = staging->saved;
+    kvfree(staging);
+    staging = saved;
+  }
+  mutex_unlock(&writeLock);
 }
 
 void matrix_set_row(int row, int val) {
+  struct matrix_image* image;
   if (matrix_check_row(row)) return;
-  for (int i = 0; i < COLS; i++) {
-    matrixBuffer[row][i] = val;
+  mutex_lock(&writeLock);
+  image = image_edit(1);
+  if (image) {
+    for (int i = 0; i < width; i++) {
+      image_set_pixel(image, row, i, val ? MATRIX_MAX_INTENSITY : 0);
+    }
+    image_edit_done(image);
   }
-  disable_scrolling();
+  mutex_unlock(&writeLock);
 }
 
 void matrix_set_col(int col, int val) {
+  struct matrix_image* image;
   if (matrix_check_col(col)) return;
-  for (int i = 0; i < ROWS; i++) {
-    matrixBuffer[i][col] = val;
+  mutex_lock(&writeLock);
+  image = image_edit(1);
+  if (image) {
+    image_fill_col(image, col, val ? matrix_col_mask() : 0);
+    image_edit_done(image);
   }
-  disable_scrolling();
+  mutex_unlock(&writeLock);
 }
 
 void matrix_set_pixel(int row, int col, int val) {
+  matrix_set_intensity(row, col, val ? MATRIX_MAX_INTENSITY : 0);
+}
+
+void matrix_set_intensity(int row, int col, int level) {
+  struct matrix_image* image;
+  bool partial;
   if (matrix_check_pixel(row, col)) return;
-  matrixBuffer[row][col] = val;
-  disable_scrolling();
+  level = clamp(level, 0, MATRIX_MAX_INTENSITY);
+  partial = level && level != MATRIX_MAX_INTENSITY;
+  mutex_lock(&writeLock);
+  image = image_edit(partial ? grayscale_bits : 1);
+  if (image) {
+    image_set_pixel(image, row, col, level);
+    image_edit_done(image);
+  }
+  mutex_unlock(&writeLock);
 }
 
-void matrix_set_character(char c) {
-  const char(*characterMap)[ROWS][COLS] = character_get_array(c);
-  for (int i = 0; i < ROWS; i++) {
-    memcpy(matrixBuffer[i], (*characterMap)[i], COLS);
+void matrix_set_character(u32 codepoint) {
+  struct glyph glyph;
+  struct matrix_image* image = image_alloc(width, 1);
+  if (!image) return;
+  character_lookup(codepoint, &glyph);
+  // from the left edge
+  for (int col = 0; col < min(character_width(panelRows), width); col++) {
+    image_fill_col(image, col, character_get_col(glyph.cols, col, panelRows));
   }
-  disable_scrolling();
+  mutex_lock(&writeLock);
+  image_publish(image);
+  mutex_unlock(&writeLock);
 }
 
-void matrix_set_string(const char* str) {
-  // copy the string so we can modify it
-  char* strCopy = kmalloc(strlen(str) + 1, GFP_KERNEL);
-  strcpy(strCopy, str);
+int matrix_append_ticker(const char* text, int length) {
+  struct matrix_image* image = NULL;
+  int queued;
 
-  // remove any newlines or returns
-  // https://stackoverflow.com/a/28462221
-  strCopy[strcspn(strCopy, "\r\n")] = 0;
+  mutex_lock(&writeLock);
+  // keep scrolling the running ticker, otherwise start one from a blank display
+  if (!image_current()->ticker) {
+    // no columns, they are the ticker's ring and never in the image
+    image = image_alloc(0, 1);
+    if (!image) {
+      mutex_unlock(&writeLock);
+      return -ENOMEM;
+    }
+    image->scrolling = true;
+    image->ticker = true;
+    ticker_reset();
+  }
+  queued = ticker_append(text, length);
+  if (image) image_publish(image);
+  mutex_unlock(&writeLock);
+  return queued;
+}
 
-  matrix_set_clear();
+static int matrix_show_string(const char* str, bool message) {
+  // ignore anything after a newline or return
+  int length = strcspn(str, "\r\n");
+  // glyphs and the gaps between them grow with the display height
+  int gap = character_gap(panelRows);
+  struct matrix_image* image;
+  struct glyph* glyphs;
+  int count = 0;
+  int imageLength = width;
+  int col = width;
 
-  // we need space for each character and a space between the characters, and a
-  // blank space at the beginning
-  matrixBufferLength = strlen(strCopy) * (COLS + 1) + COLS;
+  // str is UTF-8, so there are at most as many characters as bytes. Each is
+  // looked up once, then measured and drawn from the copy.
+  glyphs = kmalloc_array(max(length, 1), sizeof(*glyphs), GFP_KERNEL);
+  if (!glyphs) return -ENOMEM;
+  for (int i = 0; i < length; count++) {
+    u32 codepoint;
+    i += character_decode(str + i, length - i, &codepoint);
+    character_lookup(codepoint, &glyphs[count]);
+  }
 
-  for (int row = 0; row < ROWS; row++) {
-    matrixBuffer[row] =
-        krealloc(matrixBuffer[row], matrixBufferLength + COLS, GFP_KERNEL);
+  // each character takes only its own width and the gap after it, and there
+  // is one blank display at the beginning. Text is on/off so one plane is
+  // enough.
+  for (int i = 0; i < count; i++) {
+    imageLength += character_advance(&glyphs[i], panelRows) + gap;
   }
+  image = image_alloc(imageLength, 1);
+  if (!image) {
+    kfree(glyphs);
+    return -ENOMEM;
+  }
+  image->scrolling = true;
+  image->message = message;
 
   // copy each character of str into the string buffer
-  for (int i = 0; i < strlen(strCopy); i++) {
-    const char(*characterMap)[ROWS][COLS] = character_get_array(strCopy[i]);
-    for (int row = 0; row < ROWS; row++) {
-      for (int col = 0; col < COLS; col++) {
-        // copy the character map into the string buffer, and leave 1 space
-        // between characters and one screen width blank at the beggining
-        matrixBuffer[row][COLS + i * (COLS + 1) + col] =
-            (*characterMap)[row][col];
-      }
+  for (int i = 0; i < count; i++) {
+    int advance = character_advance(&glyphs[i], panelRows);
+    for (int glyphCol = 0; glyphCol < advance; glyphCol++) {
+      image_put(image, col + glyphCol, 0,
+                character_string_col(&glyphs[i], glyphCol, panelRows));
     }
+    col += advance + gap;
   }
-  // restart at the beggining
-  matrixBufferLocation = 0;
-  isMatrixScrolling = true;
-  kfree(strCopy);
+  kfree(glyphs);
+  mutex_lock(&writeLock);
+  image_publish(image);
+  mutex_unlock(&writeLock);
+  return 0;
 }
 
-const char** matrix_get_pixels(void) { return (const char**)matrixBuffer; }
+int matrix_set_string(const char* str) { return matrix_show_string(str, false); }
 
-int matrix_get_location(void) { return matrixBufferLocation; }
+int matrix_set_message(const char* str) { return matrix_show_string(str, true); }
 
-// turns off all GPIO pins
-void matrix_display_clear(void) {
-  for (int i = 0; i < COLS; i++) {
-    gpio_set_value(cols[i], 0);
+void matrix_resume(void) {
+  struct matrix_image* image;
+  struct scan_frames* frames = NULL;
+  u64 frameNsec = 0;
+
+  mutex_lock(&writeLock);
+  image = pausedImage;
+  pausedImage = NULL;
+  // an animation goes on from the frame it was interrupted on, with its
+  // programs compiled again
+  if (image && image->frames) {
+    frames = frames_compile(image);
+    if (frames) {
+      frameNsec = (u64)image->durations[READ_ONCE(image->location) / width] *
+                  NSEC_PER_USEC;
+    } else {
+      // readers from before the message may still see it
+      kvfree_rcu(image, rcu);
+      image = NULL;
+    }
+  }
+  if (!image) image = image_alloc(width, 1);
+  if (image) {
+    image_publish(image);
+    if (frames) frames_publish(frames);
+  }
+  mutex_unlock(&writeLock);
+  if (frameNsec) timer_start_animation(frameNsec);
+}
+
+bool matrix_is_message(void) {
+  bool message;
+  rcu_read_lock();
+  message = rcu_dereference(matrixImage)->message;
+  rcu_read_unlock();
+  return message;
+}
+
+// Bytes of one column in a packed frame
+static int frame_col_bytes(void) {
+  return DIV_ROUND_UP(panelRows, BITS_PER_BYTE);
+}
+
+int matrix_get_frame_size(void) { return width * frame_col_bytes(); }
+
+// Unpack a packed frame into the display wide one plane image starting at
+// column `first`
+static void image_unpack_frame(struct matrix_image* image, int first,
+                               const u8* frame) {
+  int colBytes = frame_col_bytes();
+  for (int col = 0; col < width; col++) {
+    matrix_col_t mask = 0;
+    for (int b = 0; b < colBytes; b++) {
+      mask |= (matrix_col_t)frame[col * colBytes + b] << (b * BITS_PER_BYTE);
+    }
+    image_put(image, first + col, 0, mask & matrix_col_mask());
   }
-  for (int i = 0; i < ROWS; i++) {
-    gpio_set_value(rows[i], 0);
+}
+
+void matrix_set_frame(const u8* frame) {
+  struct matrix_image* image = image_alloc(width, 1);
+  if (!image) return;
+  image_unpack_frame(image, 0, frame);
+  mutex_lock(&writeLock);
+  image_publish(image);
+  mutex_unlock(&writeLock);
+}
+
+int matrix_set_animation(const u8* frames, const u32* durations, int count,
+                         int loops) {
+  struct matrix_image* image;
+  struct scan_frames* scanFrames;
+  u32* imageDurations;
+
+  if (count < 1 || count > MATRIX_MAX_FRAMES || loops < 0) return -EINVAL;
+  for (int i = 0; i < count; i++) {
+    if (durations[i] < MATRIX_MIN_FRAME_USEC) return -EINVAL;
+  }
+  image = image_alloc_tail(count * width, 1, count * sizeof(u32));
+  if (!image) return -ENOMEM;
+  image->frames = count;
+  image->animation = atomic_inc_return(&animationIds);
+  image->loops = loops;
+  imageDurations = (u32*)&image->cols[image_cols_size(image->length, 1)];
+  memcpy(imageDurations, durations, count * sizeof(u32));
+  image->durations = imageDurations;
+  for (int i = 0; i < count; i++) {
+    image_unpack_frame(image, i * width, frames + i * matrix_get_frame_size());
+  }
+  // every frame is compiled now, stepping through them is only a flip
+  scanFrames = frames_compile(image);
+  if (!scanFrames) {
+    kvfree(image);
+    return -ENOMEM;
+  }
+  mutex_lock(&writeLock);
+  image_publish(image);
+  frames_publish(scanFrames);
+  mutex_unlock(&writeLock);
+  // time the first frame from now rather than from the last frame tick
+  timer_start_animation((u64)durations[0] * NSEC_PER_USEC);
+  return 0;
+}
+
+u64 matrix_animation_step(void) {
+  struct matrix_image* image;
+  u64 nsec = 0;
+  int frame;
+
+  rcu_read_lock();
+  image = rcu_dereference(matrixImage);
+  if (!image->frames || image->ended) goto out;
+  frame = image->location / width + 1;
+  if (frame >= image->frames) {
+    // the last play stays on its last frame
+    if (image->loops == 1) {
+      image->ended = true;
+      events_raise(MATRIX_EVENT_END);
+      goto out;
+    }
+    if (image->loops) image->loops--;
+    frame = 0;
+    events_raise(MATRIX_EVENT_WRAP);
+  }
+  WRITE_ONCE(image->location, frame * width);
+  // the scan path flips to the frame's program at the end of its cycle
+  atomic_set(&animationFrame, (u32)image->animation << 16 | frame);
+  nsec = (u64)image->durations[frame] * NSEC_PER_USEC;
+out:
+  rcu_read_unlock();
+  return nsec;
+}
+
+void matrix_get_frame(u8* frame) {
+  int colBytes = frame_col_bytes();
+  const struct matrix_image* image;
+  rcu_read_lock();
+  image = rcu_dereference(matrixImage);
+  for (int col = 0; col < width; col++) {
+    matrix_col_t lit = image_col_lit(image, col);
+    for (int b = 0; b < colBytes; b++) {
+      frame[col * colBytes + b] = lit >> (b * BITS_PER_BYTE);
+    }
+  }
+  rcu_read_unlock();
+}
+
+u8 matrix_get_pixel(int row, int col) {
+  u8 level;
+  if (matrix_check_pixel(row, col)) return 0;
+  rcu_read_lock();
+  level = image_get_pixel(rcu_dereference(matrixImage), row, col);
+  rcu_read_unlock();
+  return level;
+}
+
+matrix_col_t matrix_get_col(int col) {
+  matrix_col_t lit;
+  if (matrix_check_col(col)) return 0;
+  rcu_read_lock();
+  lit = image_col_lit(rcu_dereference(matrixImage), col);
+  rcu_read_unlock();
+  return lit;
+}
+
+int matrix_get_location(void) {
+  int location;
+  rcu_read_lock();
+  location = READ_ONCE(rcu_dereference(matrixImage)->location);
+  rcu_read_unlock();
+  return location;
+}
+
+// write every pin at once, or one at a time when batching is disabled
+static void matrix_write_pins(unsigned long *values) {
+  if (gpio_batch) {
+    // gpiolib groups the pins by chip and sets each chip in one operation
+    if (pinsCanSleep) {
+      gpiod_set_raw_array_value_cansleep(pinCount, pinDescs, NULL, values);
+    } else {
+      gpiod_set_raw_array_value(pinCount, pinDescs, NULL, values);
+    }
+    return;
+  }
+  for (int i = 0; i < pinCount; i++) {
+    int gpio = i < rowPinCount ? rows[i] : cols[i - rowPinCount];
+    if (pinsCanSleep) {
+      gpio_set_value_cansleep(gpio, test_bit(i, values));
+    } else {
+      gpio_set_value(gpio, test_bit(i, values));
+    }
   }
 }
 
+// turns off all GPIO pins
+void matrix_display_clear(void) {
+  DECLARE_BITMAP(values, PIN_COUNT);
+  bitmap_zero(values, PIN_COUNT);
+  matrix_write_pins(values);
+}
+
 void matrix_display_row(int row) {
+  DECLARE_BITMAP(values, PIN_COUNT);
+  const struct matrix_image* image;
   if (matrix_check_row(row)) return;
-  for (int i = 0; i < COLS; i++) {
-    gpio_set_value(cols[i], matrixBuffer[row][i]);
+  bitmap_zero(values, PIN_COUNT);
+  rcu_read_lock();
+  image = rcu_dereference(matrixImage);
+  // same polarity as the scan program: the row is driven high and the
+  // columns lit in it low
+  for (int i = 0; i < width; i++) {
+    __assign_bit(COL_PIN(i), values, !(image_col_lit(image, i) & BIT(row)));
   }
-  for (int i = 0; i < ROWS; i++) {
-    gpio_set_value(rows[i], i == row ? 0 : 1);
+  rcu_read_unlock();
+  for (int i = 0; i < rowPinCount; i++) {
+    __assign_bit(ROW_PIN(i), values, i % panelRows == row);
   }
+  matrix_write_pins(values);
 }
 
-// display one column of the framebuffer to the matrix
-// This is what is currently used by the timer
-void matrix_display_col(int col) {
-  if (matrix_check_col(col)) return;
-  if (matrixBufferLocation >= matrixBufferLength) return;
-  for (int i = 0; i < ROWS; i++) {
-    // set the value of the row to the value of the pixel in the framebuffer
-    gpio_set_value(rows[i], matrixBuffer[i][col + matrixBufferLocation]);
+// Copy the planes of the columns of an image shown from `location`, blank
+// past its end, and return how many planes there are.
+static int image_snapshot(const struct matrix_image* image, int location,
+                          matrix_col_t visible[MAX_WIDTH][MAX_GRAYSCALE_BITS]) {
+  int planes = image->planes;
+  for (int col = 0; col < width; col++) {
+    int imageCol = col + location;
+    if (image->ticker) {
+      visible[col][0] = ticker_get_col(col);
+      continue;
+    }
+    if (imageCol >= image->length) {
+      memset(visible[col], 0, sizeof(visible[col]));
+      continue;
+    }
+    for (int p = 0; p < planes; p++) {
+      visible[col][p] = image_get(image, imageCol, p);
+    }
+  }
+  return planes;
+}
+
+// How many slots and the most LEDs lit at once when scanning the columns
+// with the given row masks along `axis`
+static void scan_axis_measure(enum scan_axis axis, const matrix_col_t* rowMasks,
+                              struct scan_axis_info* info) {
+  int stride = sharedRows ? width : panelCols;
+  info->positions = axis == SCAN_AXIS_ROW ? panelRows : colPositions;
+  info->slots = 0;
+  info->peak = 0;
+  for (int pos = 0; pos < info->positions; pos++) {
+    int lit = 0;
+    if (axis == SCAN_AXIS_ROW) {
+      for (int col = 0; col < width; col++) lit += !!(rowMasks[col] & BIT(pos));
+    } else {
+      for (int col = pos; col < width; col += stride) {
+        lit += hweight32(rowMasks[col]);
+      }
+    }
+    if (lit) info->slots++;
+    info->peak = max(info->peak, lit);
+  }
+}
+
+// The axis giving every LED the largest share of the frame, or for the same
+// share the one lighting fewer LEDs (drawing less current) per slot
+static enum scan_axis scan_axis_pick(const struct scan_axis_info* axes) {
+  const struct scan_axis_info* col = &axes[SCAN_AXIS_COL];
+  const struct scan_axis_info* row = &axes[SCAN_AXIS_ROW];
+  int colShare = scanAllPositions ? col->positions : col->slots;
+  int rowShare = scanAllPositions ? row->positions : row->slots;
+  if (!col->slots) return SCAN_AXIS_COL;
+  if (rowShare != colShare) {
+    return rowShare < colShare ? SCAN_AXIS_ROW : SCAN_AXIS_COL;
   }
+  return row->peak < col->peak ? SCAN_AXIS_ROW : SCAN_AXIS_COL;
+}
 
-  for (int i = 0; i < COLS; i++) {
-    // and only turn on the column that we are currently displaying
-    gpio_set_value(cols[i], i == col ? 0 : 1);
+// The pins of one scan position of `axis` showing one bit plane of the image
+static bool scan_position_pins(enum scan_axis axis, int pos, int plane,
+                               unsigned long* values) {
+  matrix_col_t (*visible)[MAX_GRAYSCALE_BITS] = compileVisible;
+  int stride = sharedRows ? width : panelCols;
+  bool lit = false;
+
+  bitmap_zero(values, pinCount);
+  if (axis == SCAN_AXIS_ROW) {
+    // one row of every panel, the columns lit in that row are driven (low)
+    for (int col = 0; col < width; col++) {
+      bool on = visible[col][plane] & BIT(pos);
+      __set_bit(ROW_PIN(row_line(col, pos)), values);
+      __assign_bit(COL_PIN(col), values, !on);
+      lit |= on;
+    }
+    return lit;
   }
+  // the same column of every panel that has its own row lines
+  for (int col = pos; col < width; col += stride) {
+    matrix_col_t mask = visible[col][plane];
+    for (int i = 0; i < panelRows; i++) {
+      // set the value of the row to this plane's bit of the pixel
+      __assign_bit(ROW_PIN(row_line(col, i)), values, mask & BIT(i));
+    }
+    lit |= mask;
+  }
+  for (int i = 0; i < width; i++) {
+    // and only turn on the columns that this slot displays
+    __assign_bit(COL_PIN(i), values, i % stride != pos);
+  }
+  return lit;
+}
+
+// Compile the snapshot in compileVisible, of `imagePlanes` planes, into a
+// program. Callers hold compileLock.
+static void program_compile(struct scan_program* program, int imagePlanes) {
+  DECLARE_BITMAP(values, PIN_COUNT);
+  matrix_col_t (*visible)[MAX_GRAYSCALE_BITS] = compileVisible;
+  matrix_col_t* rowMasks = compileRowMasks;
+  // the rows every lit column of a panel (or of all, with shared row lines)
+  // has to light for the image to be static
+  matrix_col_t staticRows[MAX_PANELS] = {0};
+  enum scan_axis axis;
+  int slots = 0;
+  int planes = 1;
+
+  // only spend timer events on bit planes when something is partly lit
+  for (int col = 0; col < width; col++) {
+    for (int p = 1; p < imagePlanes; p++) {
+      if (visible[col][p] != visible[col][0]) planes = imagePlanes;
+    }
+  }
+  // keep the planes that are shown, the framebuffer's top plane when showing
+  // a single one
+  for (int col = 0; col < width; col++) {
+    rowMasks[col] = 0;
+    for (int p = 0; p < planes; p++) {
+      visible[col][p] = visible[col][imagePlanes - planes + p];
+      rowMasks[col] |= visible[col][p];
+    }
+  }
+
+  scan_axis_measure(SCAN_AXIS_COL, rowMasks, &program->axes[SCAN_AXIS_COL]);
+  scan_axis_measure(SCAN_AXIS_ROW, rowMasks, &program->axes[SCAN_AXIS_ROW]);
+  axis = READ_ONCE(scanAxis);
+  if (axis == SCAN_AXIS_AUTO) axis = scan_axis_pick(program->axes);
+  program->axis = axis;
+  program->positions = program->axes[axis].positions;
+
+  for (int pos = 0; pos < program->positions; pos++) {
+    bool lit = false;
+    for (int plane = 0; plane < planes; plane++) {
+      lit |= scan_position_pins(axis, pos, plane, values);
+      bitmap_copy(program_pins(program, pos, plane), values, pinCount);
+    }
+    if (lit) program->slots[slots++] = pos;
+  }
+  program->planeCount = planes;
+  program->slotCount = slots;
+
+  // static if every lit column lights the same rows as the others sharing
+  // its row lines
+  program->isStatic = planes == 1;
+  for (int col = 0; col < width; col++) {
+    matrix_col_t* groupRows = &staticRows[row_group(col)];
+    if (!rowMasks[col]) continue;
+    if (*groupRows && rowMasks[col] != *groupRows) program->isStatic = false;
+    *groupRows = rowMasks[col];
+  }
+  if (program->isStatic) {
+    bitmap_zero(values, pinCount);
+    for (int col = 0; col < width; col++) {
+      matrix_col_t groupRows = staticRows[row_group(col)];
+      for (int i = 0; i < panelRows; i++) {
+        if (groupRows & BIT(i)) __set_bit(ROW_PIN(row_line(col, i)), values);
+      }
+      // columns are active low, drive every lit one
+      __assign_bit(COL_PIN(col), values, !rowMasks[col]);
+    }
+    bitmap_copy(program->staticPins, values, pinCount);
+  }
+}
+
+// Hand the back program to the scan path, carrying `frames` when it is an
+// animation. Callers hold compileLock, which they drop.
+static void program_publish(struct scan_frames* frames) {
+  struct scan_program* program = &scanPrograms[scanBack];
+  // the frames this program carried last time may still be on the pins
+  if (program->frames) kvfree_rcu(program->frames, rcu);
+  program->frames = frames;
+  // publish, and take back whichever program is not in use (atomic_xchg is a
+  // full barrier, pairing with the one in the scanline timer's stop check)
+  scanBack = atomic_xchg(&scanPending, scanBack | PROGRAM_FRESH);
+  scanBack &= ~PROGRAM_FRESH;
+  mutex_unlock(&compileLock);
+  // the scanline timer may be stopped on the previous image
+  timer_kick_scanline();
+}
+
+// Rebuild the scan program from the visible part of the framebuffer. An
+// animation is left alone, all of its frames are compiled by frames_compile.
+static void matrix_compile(void) {
+  const struct matrix_image* image;
+  int planes;
+
+  // Snapshot under the lock, so whichever compile runs last also saw the
+  // newest image
+  mutex_lock(&compileLock);
+  rcu_read_lock();
+  image = rcu_dereference(matrixImage);
+  if (image->frames) {
+    rcu_read_unlock();
+    mutex_unlock(&compileLock);
+    return;
+  }
+  planes = image_snapshot(image, READ_ONCE(image->location), compileVisible);
+  rcu_read_unlock();
+  program_compile(&scanPrograms[scanBack], planes);
+  program_publish(NULL);
+}
+
+// Compile every frame of an animation image, before it is published or with
+// writeLock held
+static struct scan_frames* frames_compile(const struct matrix_image* image) {
+  int pinLongs = BITS_TO_LONGS(pinCount);
+  // every frame is a single plane, the programs' arrays follow them
+  size_t pinsSize = maxPositions * pinLongs + pinLongs;
+  struct scan_frames* frames;
+  unsigned long* pins;
+  int* slots;
+
+  frames = kvzalloc(struct_size(frames, programs, image->frames) +
+                        array3_size(image->frames, pinsSize, sizeof(long)) +
+                        array3_size(image->frames, maxPositions, sizeof(int)),
+                    GFP_KERNEL);
+  if (!frames) return NULL;
+  frames->animation = image->animation;
+  frames->count = image->frames;
+  pins = (unsigned long*)&frames->programs[frames->count];
+  slots = (int*)&pins[frames->count * pinsSize];
+
+  mutex_lock(&compileLock);
+  for (int i = 0; i < frames->count; i++) {
+    struct scan_program* program = &frames->programs[i];
+    program->pins = &pins[i * pinsSize];
+    program->staticPins = &program->pins[maxPositions * pinLongs];
+    program->slots = &slots[i * maxPositions];
+    program->planeStride = 1;
+    program_compile(program, image_snapshot(image, i * width, compileVisible));
+    // the next frame has to be able to flip in, so never latch one
+    program->isStatic = false;
+  }
+  mutex_unlock(&compileLock);
+  return frames;
+}
+
+// Start showing the compiled frames of the animation that is the framebuffer
+static void frames_publish(struct scan_frames* frames) {
+  mutex_lock(&compileLock);
+  program_publish(frames);
+}
+
+// Compile the framebuffer again after a scan setting changed
+static void matrix_recompile(void) {
+  struct matrix_image* image;
+  struct scan_frames* frames;
+  mutex_lock(&writeLock);
+  image = image_current();
+  if (!image->frames) {
+    matrix_compile();
+  } else {
+    // keeps playing on the old programs if there is no memory for new ones
+    frames = frames_compile(image);
+    if (frames) frames_publish(frames);
+  }
+  mutex_unlock(&writeLock);
+}
+
+// The frame of an animation the frame timer picked last, its first until the
+// timer has moved on to it
+static int frames_pick(const struct scan_frames* frames) {
+  u32 value = atomic_read(&animationFrame);
+  if (value >> 16 != frames->animation) return 0;
+  return min_t(int, value & 0xffff, frames->count - 1);
+}
+
+bool matrix_flip_pending(void) {
+  struct scan_frames* frames = scanPrograms[scanFront].frames;
+  if (atomic_read(&scanPending) & PROGRAM_FRESH) return true;
+  return frames && frames_pick(frames) != scanFrame;
+}
+
+bool matrix_flip(void) {
+  struct scan_frames* frames;
+  int frame;
+  bool flipped = false;
+  if (atomic_read(&scanPending) & PROGRAM_FRESH) {
+    scanFront = atomic_xchg(&scanPending, scanFront) & ~PROGRAM_FRESH;
+    flipped = true;
+  }
+  // a new frame of an animation is flipped in the same way as a new image
+  frames = scanPrograms[scanFront].frames;
+  frame = frames ? frames_pick(frames) : 0;
+  if (frame != scanFrame) flipped = true;
+  WRITE_ONCE(scanFrame, frame);
+  return flipped;
+}
+
+// The program being shown. Callers hold rcu_read_lock, as the frames of an
+// animation are freed once it is replaced.
+static struct scan_program *front_program(void) {
+  struct scan_program *program = &scanPrograms[READ_ONCE(scanFront)];
+  struct scan_frames *frames = READ_ONCE(program->frames);
+  if (!frames) return program;
+  // readers outside the scan path may see the program before its frame
+  return &frames->programs[min(READ_ONCE(scanFrame), frames->count - 1)];
+}
+
+// display one bit plane of one column of the framebuffer to the matrix
+// This only replays the compiled scan program
+void matrix_display_col(int col, int plane) {
+  DECLARE_BITMAP(values, PIN_COUNT);
+  struct scan_program *program;
+  rcu_read_lock();
+  program = front_program();
+  if (col < 0 || col >= program->positions) {
+    rcu_read_unlock();
+    return;
+  }
+  if (plane >= program->planeCount) plane = 0;
+  // copied out so the pins are written outside the rcu section
+  bitmap_copy(values, program_pins(program, col, plane), pinCount);
+  rcu_read_unlock();
+  matrix_write_pins(values);
+}
+
+int matrix_get_scan_slots(void) {
+  int slots;
+  rcu_read_lock();
+  slots = front_program()->slotCount;
+  rcu_read_unlock();
+  return slots;
+}
+
+int matrix_get_max_scan_positions(void) { return maxPositions; }
+
+int matrix_get_scan_positions(void) {
+  int positions;
+  rcu_read_lock();
+  positions = front_program()->positions;
+  rcu_read_unlock();
+  return positions;
+}
+
+enum scan_axis matrix_get_scan_axis(void) {
+  enum scan_axis axis;
+  rcu_read_lock();
+  axis = front_program()->axis;
+  rcu_read_unlock();
+  return axis;
+}
+
+void matrix_get_scan_axis_info(enum scan_axis axis,
+                               struct scan_axis_info* info) {
+  rcu_read_lock();
+  *info = front_program()->axes[axis];
+  rcu_read_unlock();
+}
+
+enum scan_axis matrix_get_scan_axis_setting(void) { return READ_ONCE(scanAxis); }
+
+const char* matrix_scan_axis_name(enum scan_axis axis) {
+  return scanAxisNames[axis];
+}
+
+int matrix_set_scan_axis(const char* name) {
+  int axis = sysfs_match_string(scanAxisNames, name);
+  if (axis < 0) return -EINVAL;
+  WRITE_ONCE(scanAxis, axis);
+  matrix_recompile();
+  return 0;
+}
+
+void matrix_set_scan_all(bool all) {
+  WRITE_ONCE(scanAllPositions, all);
+  matrix_recompile();
+}
+
+int matrix_get_rows(void) { return panelRows; }
+
+int matrix_get_cols(void) { return panelCols; }
+
+int matrix_get_width(void) { return width; }
+
+matrix_col_t matrix_col_mask(void) { return GENMASK(panelRows - 1, 0); }
+
+bool matrix_is_static(void) {
+  bool isStatic;
+  rcu_read_lock();
+  isStatic = front_program()->isStatic;
+  rcu_read_unlock();
+  return isStatic;
+}
+
+void matrix_display_static(void) {
+  DECLARE_BITMAP(values, PIN_COUNT);
+  rcu_read_lock();
+  bitmap_copy(values, front_program()->staticPins, pinCount);
+  rcu_read_unlock();
+  matrix_write_pins(values);
+}
+
+int matrix_get_scan_planes(void) {
+  int planes;
+  rcu_read_lock();
+  planes = front_program()->planeCount;
+  rcu_read_unlock();
+  return planes;
+}
+
+void matrix_display_slot(int slot, int plane) {
+  struct scan_program *program;
+  int col;
+  rcu_read_lock();
+  program = front_program();
+  // a late thread or worker may run after the next flip
+  if (slot >= program->slotCount) slot = 0;
+  col = program->slots[slot];
+  rcu_read_unlock();
+  // a new frame flipped in meanwhile is shown from this position on
+  matrix_display_col(col, plane);
 }
 
 // display the next column of the framebuffer to the matrix, wrap at end
-void matrix_display_scroll(void) {
-  if (!isMatrixScrolling) return;
-  if (matrixBuffer == NULL) return;
-  if (matrixBufferLocation >= matrixBufferLength) matrixBufferLocation = 0;
-  matrixBufferLocation++;
+// Only the frame path calls this, so it is the only writer of the location
+bool matrix_display_scroll(void) {
+  struct matrix_image* image;
+  bool scrolling, message;
+  bool wrapped = false;
+
+  rcu_read_lock();
+  image = rcu_dereference(matrixImage);
+  // the frame timer has already moved an animation on, and its programs are
+  // compiled, so only the event is left
+  scrolling = image->scrolling || image->frames;
+  message = image->message;
+  if (image->ticker) {
+    ticker_scroll();
+  } else if (image->scrolling) {
+    int location = image->location;
+    if (location >= image->length) {
+      // the last column has scrolled off, start the next pass
+      WRITE_ONCE(image->location, 1);
+      events_raise(MATRIX_EVENT_WRAP);
+      wrapped = true;
+    } else {
+      WRITE_ONCE(image->location, location + 1);
+    }
+  }
+  rcu_read_unlock();
+  // the next message is shown from its start in place of another pass
+  if (wrapped && message && playlist_wrap()) return true;
+  if (scrolling) matrix_compile();
+  return scrolling;
 }
\ No newline at end of file
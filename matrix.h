@@ -1,10 +1,59 @@
-#define COLS 5
-#define ROWS 7
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <linux/bits.h>
+#include <linux/types.h>
+
+// the size of one panel is set at load time, up to MAX_ROWS by MAX_COLS
+#define DEFAULT_ROWS 7
+#define DEFAULT_COLS 5
+#define MAX_ROWS 32
+#define MAX_COLS 32
+// panels can be chained side by side into one wider display
+#define MAX_PANELS 8
+#define MAX_WIDTH (MAX_PANELS * MAX_COLS)
+// Limits of an uploaded animation. Frames shorter than one 10ms scan cycle
+// can be skipped, an image is only flipped in at the end of a cycle.
+#define MATRIX_MAX_FRAMES 1024
+#define MATRIX_MIN_FRAME_USEC 1000
+
+// pixels hold an intensity from 0 (off) to MATRIX_MAX_INTENSITY
+#define MATRIX_MAX_INTENSITY 255
+#define MAX_GRAYSCALE_BITS 8
+
+// one framebuffer column, bit r set when row r is lit. Images store columns
+// in the smallest word holding panel_rows, this is how they are passed around.
+typedef u32 matrix_col_t;
+
+// which lines are multiplexed, selected with the scan_axis attribute
+enum scan_axis {
+  SCAN_AXIS_COL,   // one column (of every panel with own row lines) at a time
+  SCAN_AXIS_ROW,   // one row of every panel at a time
+  SCAN_AXIS_AUTO,  // whichever gives the current image the higher duty cycle
+};
+
+// what scanning the current image along one axis takes
+struct scan_axis_info {
+  int positions;  // scan positions along the axis
+  int slots;      // positions with something lit
+  int peak;       // most LEDs lit at once in one slot
+};
 
 // verify and initialize the GPIO pins
 int matrix_init(void);
 // turn off all GPIO pins and release them
 int matrix_free(void);
+// check if any of the GPIO pins may sleep (not usable from atomic context)
+bool matrix_gpio_can_sleep(void);
+
+// number of rows of the display
+int matrix_get_rows(void);
+// number of columns of one panel
+int matrix_get_cols(void);
+// number of columns of the whole display, every panel side by side
+int matrix_get_width(void);
+// a framebuffer column with every row lit
+matrix_col_t matrix_col_mask(void);
 
 // check if the column is valid
 int matrix_check_col(int col);
@@ -15,19 +64,61 @@ int matrix_check_pixel(int row, int col);
 
 // set the framebuffer to all zeros
 void matrix_set_clear(void);
+// Collect the following clear, row, column, pixel and intensity edits in a
+// staging image, copied from the current image or blank, instead of showing
+// each one. Transactions nest and the outermost commit shows every edit at
+// once.
+int matrix_begin(bool blank);
+int matrix_commit(void);
+// Close the innermost transaction without showing it, putting back the staged
+// edits as they were when it began.
+void matrix_abort(void);
 // set the value of one row
 void matrix_set_row(int row, int val);
 // set the value of one column
 void matrix_set_col(int col, int val);
-// set the value of one pixel
+// set the value of one pixel, on at full intensity or off
 void matrix_set_pixel(int row, int col, int val);
-// set the framebuffer to a representation of a character
-void matrix_set_character(char c);
+// set the intensity of one pixel, 0 to MATRIX_MAX_INTENSITY
+void matrix_set_intensity(int row, int col, int level);
+// set the framebuffer to a representation of a unicode character
+void matrix_set_character(u32 codepoint);
 // set the framebuffer to a representation of a string
-void matrix_set_string(const char *str);
+int matrix_set_string(const char *str);
+// the same for a playlist message, which calls playlist_wrap at the end of
+// every pass instead of starting over by itself
+int matrix_set_message(const char *str);
+// whether the framebuffer is a playlist message
+bool matrix_is_message(void);
+// show again what the first playlist message replaced, or a blank display.
+// Publishes straight away, even while a transaction is open.
+void matrix_resume(void);
+// queue text to scroll on after whatever is already scrolling, starting a
+// ticker if a different image is showing. Returns how many bytes fit.
+int matrix_append_ticker(const char *text, int length);
 
-// get the current framebuffer
-const char** matrix_get_pixels(void);
+// A packed frame holds every column of the display in turn, left to right,
+// as DIV_ROUND_UP(rows, 8) bytes with bit r (least significant byte first)
+// set when row r is lit
+// size of a packed frame in bytes
+int matrix_get_frame_size(void);
+// set the framebuffer to a packed frame, every lit pixel at full intensity
+void matrix_set_frame(const u8 *frame);
+// get the framebuffer as a packed frame, any intensity counts as lit
+void matrix_get_frame(u8 *frame);
+// Play `count` packed frames back to back, frame i for durations[i]
+// microseconds, `loops` times or for ever when 0. The last frame stays up
+// once it is done, any other image stops it.
+int matrix_set_animation(const u8 *frames, const u32 *durations, int count,
+                         int loops);
+// Move a playing animation on to its next frame and return how long that one
+// is shown in nanoseconds, 0 when nothing is playing. Called by the frame timer.
+u64 matrix_animation_step(void);
+
+// get the intensity of one pixel of the framebuffer
+u8 matrix_get_pixel(int row, int col);
+// get the lit rows of one column of the framebuffer, at any intensity
+matrix_col_t matrix_get_col(int col);
 // get the current framebuffer location (column)
 int matrix_get_location(void);
 
@@ -35,7 +126,45 @@ int matrix_get_location(void);
 void matrix_display_clear(void);
 // display one row of the framebuffer to the matrix
 void matrix_display_row(int row);
-// display one column of the framebuffer to the matrix
-void matrix_display_col(int col);
-// Scroll the framebuffer one line across the matrix
-void matrix_display_scroll(void);
\ No newline at end of file
+// display one bit plane of one scan position of the framebuffer to the matrix
+void matrix_display_col(int col, int plane);
+// select the scan axis by name (col, row or auto)
+int matrix_set_scan_axis(const char *name);
+// the scan axis selected, possibly auto
+enum scan_axis matrix_get_scan_axis_setting(void);
+const char *matrix_scan_axis_name(enum scan_axis axis);
+// tell auto whether blank scan positions are scanned too
+void matrix_set_scan_all(bool all);
+// The scan queries below describe the image the scan path is showing, which
+// changes only at matrix_flip
+// the axis being scanned, never auto
+enum scan_axis matrix_get_scan_axis(void);
+// what scanning the image along either axis takes
+void matrix_get_scan_axis_info(enum scan_axis axis,
+                               struct scan_axis_info *info);
+// number of scan positions along the axis: the rows, or the panel columns
+// when every panel has its own row lines (all panels scan in parallel), all
+// display columns otherwise
+int matrix_get_scan_positions(void);
+// the most scan positions either axis has, whichever one is in use
+int matrix_get_max_scan_positions(void);
+// number of scan positions with at least one lit pixel
+int matrix_get_scan_slots(void);
+// number of bit planes each column is shown in, plane p is weighted 2^p
+int matrix_get_scan_planes(void);
+// display one bit plane of the n-th scan position with at least one lit pixel
+void matrix_display_slot(int slot, int plane);
+// check if a newly compiled image is waiting to be shown
+bool matrix_flip_pending(void);
+// start showing the newest compiled image, if there is one. Only the scan
+// path calls this, between two scan cycles
+bool matrix_flip(void);
+// check if the image can be shown without scanning
+bool matrix_is_static(void);
+// drive every lit column at once, only valid when matrix_is_static()
+void matrix_display_static(void);
+// Scroll the framebuffer one line across the matrix, false when the image is
+// not scrolling
+bool matrix_display_scroll(void);
+
+#endif  // MATRIX_H
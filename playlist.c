@@ -0,0 +1,198 @@
+#include "playlist.h"
+
+#include <linux/jiffies.h>
+#include <linux/limits.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sysfs.h>
+
+#include "matrix.h"
+#include "timer.h"
+
+struct playlist_message {
+  struct list_head node;
+  int priority;
+  int repeat;  // passes left, 0 for ever
+  int fps;
+  unsigned long expires;  // jiffies, 0 for never
+  char text[];
+};
+
+// Messages in the order they were queued. Writers add and the frame path
+// moves on to the next message, both under playlistLock.
+static LIST_HEAD(playlist);
+static int playlistLength = 0;
+static struct playlist_message *playing = NULL;  // the one showing, or NULL
+// The message an urgent one cut short, shown again first when it is done
+static struct playlist_message *interrupted = NULL;
+// The frame rate of what the first message replaced, put back with it when
+// the playlist runs out
+static ktime_t resumeInterval;
+// The frame rate message_show last switched to
+static int playingFps = 0;
+static DEFINE_MUTEX(playlistLock);
+
+static bool message_expired(const struct playlist_message *message) {
+  return message->expires && time_after(jiffies, message->expires);
+}
+
+static void message_remove(struct playlist_message *message) {
+  if (message == playing) playing = NULL;
+  if (message == interrupted) interrupted = NULL;
+  list_del(&message->node);
+  playlistLength--;
+  kfree(message);
+}
+
+// Show a message from its start at its own speed
+static int message_show(struct playlist_message *message) {
+  int fps = message->fps ? message->fps : DEFAULT_SCROLL_FPS;
+  int ret = matrix_set_message(message->text);
+  if (ret) return ret;
+  playing = message;
+  playingFps = fps;
+  timer_set_frame_interval(0, NSEC_PER_SEC / fps);
+  return 0;
+}
+
+// The message to show after `after`: the interrupted one if it is due again,
+// or else the next one in queue order among those with the highest priority,
+// round robin. `after` itself only counts while `again` is set, and only comes
+// round again when nothing else has its priority.
+static struct playlist_message *message_next(struct playlist_message *after,
+                                             bool again) {
+  struct playlist_message *message, *first = NULL, *next = NULL;
+  bool passed = false;
+  int priority = INT_MIN;
+
+  list_for_each_entry(message, &playlist, node) {
+    if (message != after || again) priority = max(priority, message->priority);
+  }
+  if (interrupted && interrupted != after &&
+      interrupted->priority == priority) {
+    next = interrupted;
+    interrupted = NULL;
+    return next;
+  }
+  list_for_each_entry(message, &playlist, node) {
+    if (message == after) {
+      passed = true;
+      continue;
+    }
+    if (message->priority != priority) continue;
+    if (!first) first = message;
+    if (passed && !next) next = message;
+  }
+  if (!next) next = first;
+  if (!next && again && after->priority == priority) next = after;
+  return next;
+}
+
+int playlist_add(int priority, int repeat, int fps, int expirySec,
+                 const char *text, int length) {
+  struct playlist_message *message;
+  int ret = 0;
+
+  if (repeat < 0 || fps < 0 || expirySec < 0 || length > PLAYLIST_MAX_TEXT) {
+    return -EINVAL;
+  }
+  message = kzalloc(struct_size(message, text, length + 1), GFP_KERNEL);
+  if (!message) return -ENOMEM;
+  message->priority = priority;
+  message->repeat = repeat;
+  message->fps = fps;
+  if (expirySec) message->expires = jiffies + (unsigned long)expirySec * HZ;
+  memcpy(message->text, text, length);
+
+  mutex_lock(&playlistLock);
+  if (playlistLength >= PLAYLIST_MAX_MESSAGES) {
+    mutex_unlock(&playlistLock);
+    kfree(message);
+    return -ENOSPC;
+  }
+  list_add_tail(&message->node, &playlist);
+  playlistLength++;
+  // an urgent message interrupts, the interrupted one stays queued and
+  // starts its pass over when its turn comes again. Anything else showing
+  // that is not a message gives way to the playlist right away.
+  if (!playing || !matrix_is_message() || priority > playing->priority) {
+    struct playlist_message *cut = playing;
+    if (!matrix_is_message()) resumeInterval = timer_get_frame_interval();
+    ret = message_show(message);
+    if (ret) {
+      message_remove(message);
+    } else if (cut && priority > cut->priority) {
+      interrupted = cut;
+    }
+  }
+  mutex_unlock(&playlistLock);
+  return ret;
+}
+
+void playlist_clear(void) {
+  struct playlist_message *message, *tmp;
+  mutex_lock(&playlistLock);
+  list_for_each_entry_safe(message, tmp, &playlist, node) {
+    message_remove(message);
+  }
+  mutex_unlock(&playlistLock);
+}
+
+int playlist_get_fps(void) {
+  int fps;
+  mutex_lock(&playlistLock);
+  fps = matrix_is_message() ? playingFps : 0;
+  mutex_unlock(&playlistLock);
+  return fps;
+}
+
+int playlist_print(char *buf) {
+  struct playlist_message *message;
+  int len = 0;
+  mutex_lock(&playlistLock);
+  list_for_each_entry(message, &playlist, node) {
+    long left = message->expires ? (long)(message->expires - jiffies) / HZ : 0;
+    len += sysfs_emit_at(buf, len, "%c%d %d %d %ld %s\n",
+                         message == playing ? '*' : ' ', message->priority,
+                         message->repeat, message->fps, max(left, 0L),
+                         message->text);
+  }
+  mutex_unlock(&playlistLock);
+  return len;
+}
+
+bool playlist_wrap(void) {
+  struct playlist_message *message, *tmp, *next;
+  bool finished;
+
+  mutex_lock(&playlistLock);
+  if (!playing) {
+    // the playlist was cleared, the last message goes on as a plain string
+    mutex_unlock(&playlistLock);
+    return false;
+  }
+  finished =
+      (playing->repeat && !--playing->repeat) || message_expired(playing);
+  list_for_each_entry_safe(message, tmp, &playlist, node) {
+    if (message != playing && message_expired(message)) message_remove(message);
+  }
+  next = message_next(playing, !finished);
+  if (next == playing) {
+    // the only message left goes round again
+    mutex_unlock(&playlistLock);
+    return false;
+  }
+  if (finished) message_remove(playing);
+  if (!next || message_show(next)) {
+    // nothing left to show, what the playlist interrupted carries on. This
+    // publishes directly, a transaction being edited is left alone.
+    playing = NULL;
+    timer_restore_frame_interval(resumeInterval);
+    matrix_resume();
+  }
+  mutex_unlock(&playlistLock);
+  return true;
+}
+
+void playlist_exit(void) { playlist_clear(); }
@@ -0,0 +1,22 @@
+#include <linux/types.h>
+
+// Most messages the playlist holds, and the longest text of one
+#define PLAYLIST_MAX_MESSAGES 32
+#define PLAYLIST_MAX_TEXT 256
+
+// Queue a message shown `repeat` times (0 for ever) at `fps` (0 for the
+// default), until `expirySec` seconds from now (0 for never). One with a
+// higher priority than the message showing interrupts it at once.
+int playlist_add(int priority, int repeat, int fps, int expirySec,
+                 const char *text, int length);
+// Drop every message, the one showing keeps scrolling as a plain string
+void playlist_clear(void);
+// The frame rate of the message showing, 0 when the display is not showing one
+int playlist_get_fps(void);
+// Print the queue, the message showing marked with a *
+int playlist_print(char *buf);
+// Called by the frame path when a message has scrolled off completely. Shows
+// the next message and returns true, or false to let it start over.
+bool playlist_wrap(void);
+// Free every message
+void playlist_exit(void);
@@ -0,0 +1,72 @@
+#!/bin/sh
+# Pixel edits per second through the per-token path, where every write to
+# pixels is its own transaction and publishes one image, against the same
+# edits collected in an open transaction or sent as one write.
+#
+# Needs the module loaded (a gpio-sim chip will do) and root.
+#   usage: sh scripts/bench-transactions.sh [edits] [cols] [rows]
+# The display is left with whatever the last edit drew.
+
+set -e
+SYS=${SYS:-/sys/led-matrix}
+EDITS=${1:-2000}
+COLS=${2:-5}
+ROWS=${3:-7}
+
+[ -w "$SYS/pixels" ] || { echo "$SYS/pixels is not writable" >&2; exit 1; }
+
+# The i-th edit into $token: walk the display, lighting a pixel on even
+# passes and clearing it on odd ones. Set in this shell, so building a token
+# costs no fork in any of the runs.
+token() {
+  cell=$(( $1 % (COLS * ROWS) ))
+  col=$(( cell % COLS + 1 ))
+  [ $(( $1 / (COLS * ROWS) % 2 )) = 1 ] && col=-$col
+  token="$col,$(( cell / COLS + 1 ))"
+}
+
+now() { date +%s%N; }
+
+report() {
+  elapsed=$(( $(now) - $2 ))
+  echo "$1: $EDITS edits in $(( elapsed / 1000000 )) ms," \
+       "$(( EDITS * 1000000000 / elapsed )) edits/s"
+}
+
+echo abort > "$SYS/transaction" 2>/dev/null || true
+
+start=$(now)
+i=0
+while [ $i -lt "$EDITS" ]; do
+  token $i
+  echo "$token" > "$SYS/pixels"
+  i=$((i + 1))
+done
+report "per token" "$start"
+
+start=$(now)
+echo begin > "$SYS/transaction"
+i=0
+while [ $i -lt "$EDITS" ]; do
+  token $i
+  echo "$token" > "$SYS/pixels"
+  i=$((i + 1))
+done
+echo commit > "$SYS/transaction"
+report "transaction" "$start"
+
+# a sysfs write is at most a page, so the tokens go in writes of 500
+start=$(now)
+i=0
+while [ $i -lt "$EDITS" ]; do
+  batch=""
+  j=0
+  while [ $j -lt 500 ] && [ $i -lt "$EDITS" ]; do
+    token $i
+    batch="$batch $token"
+    i=$((i + 1))
+    j=$((j + 1))
+  done
+  echo "$batch" > "$SYS/pixels"
+done
+report "batched" "$start"
@@ -0,0 +1,89 @@
+#!/bin/sh
+# Scanline latency while writers hammer the display: one process each keeps
+# writing pixels, string and frame as fast as it can, so images are built,
+# published and compiled all the time, while the scanline latency histogram
+# is read every few seconds. The scan path should not notice the writers.
+#
+# Needs the module loaded (a gpio-sim chip will do), debugfs mounted and root.
+#   usage: sh scripts/stress-writers.sh [seconds] [cols] [rows] [interval]
+# The histograms are reset first, and the display is left with whatever the
+# last writer drew.
+
+set -e
+SYS=${SYS:-/sys/led-matrix}
+DBG=${DBG:-/sys/kernel/debug/led-matrix}
+SECONDS_LEFT=${1:-30}
+COLS=${2:-5}
+ROWS=${3:-7}
+INTERVAL=${4:-5}
+
+for f in pixels string frame; do
+  [ -w "$SYS/$f" ] || { echo "$SYS/$f is not writable" >&2; exit 1; }
+done
+[ -r "$DBG/scanline_latency" ] || {
+  echo "$DBG/scanline_latency is not readable, is debugfs mounted?" >&2
+  exit 1
+}
+
+# a frame column is ceil(rows / 8) bytes, as frame_col_bytes in the module
+colBytes=$(( (ROWS + 7) / 8 ))
+FRAME=$(( COLS * colBytes ))
+
+# The writers run until this file appears, and test is a builtin, so the
+# loops fork nothing but the frame writer's dd
+STOP=$(mktemp -u /tmp/stress-writers.XXXXXX)
+trap 'touch "$STOP"; wait; rm -f "$STOP"' EXIT INT TERM
+
+pixels_writer() {
+  n=0
+  while [ ! -e "$STOP" ]; do
+    col=$(( n % COLS + 1 ))
+    row=$(( n / COLS % ROWS + 1 ))
+    [ $(( n / (COLS * ROWS) % 2 )) = 1 ] && col=-$col
+    echo "$col,$row" > "$SYS/pixels"
+    n=$((n + 1))
+  done
+  echo "pixels: $n writes"
+}
+
+string_writer() {
+  n=0
+  while [ ! -e "$STOP" ]; do
+    echo "stress $n" > "$SYS/string"
+    n=$((n + 1))
+  done
+  echo "string: $n writes"
+}
+
+frame_writer() {
+  n=0
+  while [ ! -e "$STOP" ]; do
+    # a frame has to arrive in one write
+    dd if=/dev/urandom of="$SYS/frame" bs=$FRAME count=1 2>/dev/null
+    n=$((n + 1))
+  done
+  echo "frame: $n writes"
+}
+
+# count, min, max, p50 and p99 on one line
+summary() {
+  grep -E '^(count|min|max|p50|p99) ' "$DBG/scanline_latency" | paste -s -d ' ' -
+}
+
+echo 1 > "$DBG/reset"
+echo "before: $(summary)"
+
+pixels_writer &
+string_writer &
+frame_writer &
+
+elapsed=0
+while [ $elapsed -lt "$SECONDS_LEFT" ]; do
+  sleep "$INTERVAL"
+  elapsed=$((elapsed + INTERVAL))
+  echo "${elapsed}s: $(summary)"
+done
+
+touch "$STOP"
+wait
+echo "after: $(summary)"
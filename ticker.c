@@ -0,0 +1,100 @@
+#include "ticker.h"
+
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+
+#include "characters.h"
+
+// The text waiting to scroll on, as a ring buffer. Each character is only
+// turned into glyph columns as it reaches the edge of the display, so memory
+// use does not depend on how long the text is.
+static DEFINE_KFIFO(tickerText, char, TICKER_TEXT_SIZE);
+// The glyph being scrolled on and its next column. Columns past the glyph are
+// the gap before the next character.
+static struct glyph tickerGlyph;
+static bool tickerWaiting = true;  // for text, between two characters
+static int tickerGlyphCol = 0;
+// The columns on the display, as a ring whose leftmost column is at
+// tickerStart. They are kept here rather than in the published image, which
+// is never modified in place, and only the frame path scrolls them.
+static matrix_col_t tickerCols[MAX_WIDTH];
+static int tickerStart = 0;
+// Writers append while the frame path renders and readers copy the columns
+static DEFINE_SPINLOCK(tickerLock);
+
+void ticker_reset(void) {
+  spin_lock(&tickerLock);
+  kfifo_reset(&tickerText);
+  tickerWaiting = true;
+  tickerGlyphCol = 0;
+  memset(tickerCols, 0, sizeof(tickerCols));
+  tickerStart = 0;
+  spin_unlock(&tickerLock);
+}
+
+int ticker_append(const char *text, int length) {
+  int queued;
+  spin_lock(&tickerLock);
+  // text cut short ends on a whole UTF-8 character
+  if (length > kfifo_avail(&tickerText)) {
+    length = kfifo_avail(&tickerText);
+    while (length > 0 && (text[length] & 0xc0) == 0x80) length--;
+  }
+  queued = kfifo_in(&tickerText, text, length);
+  spin_unlock(&tickerLock);
+  return queued;
+}
+
+int ticker_pending(void) {
+  int pending;
+  spin_lock(&tickerLock);
+  pending = kfifo_len(&tickerText);
+  spin_unlock(&tickerLock);
+  return pending;
+}
+
+// Render the next column to scroll on, blank when the text has run out.
+// Callers hold tickerLock.
+static matrix_col_t ticker_next_col(void) {
+  int rows = matrix_get_rows();
+  matrix_col_t mask = 0;
+  char text[4];
+  int length;
+
+  length = 0;
+  if (tickerWaiting) length = kfifo_out_peek(&tickerText, text, sizeof(text));
+  // a character split across two writes waits for the rest of it
+  if (length && length >= character_utf8_length(text[0])) {
+    u32 codepoint;
+    length = character_decode(text, length, &codepoint);
+    kfifo_out(&tickerText, text, length);
+    character_lookup(codepoint, &tickerGlyph);
+    tickerWaiting = false;
+    tickerGlyphCol = 0;
+  }
+  if (!tickerWaiting) {
+    int advance = character_advance(&tickerGlyph, rows);
+    if (tickerGlyphCol < advance) {
+      mask = character_string_col(&tickerGlyph, tickerGlyphCol, rows);
+    }
+    // then the blank columns between two characters
+    if (++tickerGlyphCol >= advance + character_gap(rows)) tickerWaiting = true;
+  }
+  return mask;
+}
+
+void ticker_scroll(void) {
+  spin_lock(&tickerLock);
+  // the column scrolling off becomes the one scrolling on
+  tickerCols[tickerStart] = ticker_next_col();
+  tickerStart = (tickerStart + 1) % matrix_get_width();
+  spin_unlock(&tickerLock);
+}
+
+matrix_col_t ticker_get_col(int col) {
+  matrix_col_t mask;
+  spin_lock(&tickerLock);
+  mask = tickerCols[(tickerStart + col) % matrix_get_width()];
+  spin_unlock(&tickerLock);
+  return mask;
+}
@@ -0,0 +1,16 @@
+#include "matrix.h"
+
+// Bytes of text the ticker can hold before it has scrolled onto the display
+#define TICKER_TEXT_SIZE 4096
+
+// Drop all pending text and start the next column at a character boundary
+void ticker_reset(void);
+// Queue text behind whatever is still scrolling, returns how much fit
+int ticker_append(const char *text, int length);
+// Bytes of text that have not started scrolling on yet
+int ticker_pending(void);
+// Scroll the display one column, rendering the next column of text on the
+// right, blank when the text has run out. Only the frame path calls this.
+void ticker_scroll(void);
+// Column `col` of the display, counted from the left, while a ticker shows
+matrix_col_t ticker_get_col(int col);
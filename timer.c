@@ -1,43 +1,299 @@
 #include <linux/delay.h>
 #include <linux/hrtimer.h>
 #include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/sched/types.h>
+#include <linux/smp.h>
+#include <linux/string.h>
 
+#include "device.h"
+#include "latency.h"
 #include "matrix.h"
+#include "timer.h"
 
-static ktime_t scanlineTimerInterval;  // How long to hold each scanline
+static ktime_t scanFrameInterval;      // How long to scan the whole display
 static ktime_t frameTimerInterval;     // How long to hold each frame
 static struct hrtimer scanlineTimer;   // The timer for the scanlines
 static struct hrtimer frameTimer;      // The timer for the frames
+static enum hrtimer_mode scanlineTimerMode = HRTIMER_MODE_REL;
 static int currentCol = 0;             // The current column being displayed
+static int currentPlane = 0;           // The bit plane of that column
+static bool blankPhase = false;        // Blanked for the rest of the slot
+static ktime_t blankInterval;          // How long the blank phase lasts
+
+// Static drive: the image needs no scanning, its pins are latched once and
+// the scanline timer stays off until the framebuffer changes
+static bool scanlineStopped = false;  // timer not rearmed, waiting for a kick
+static bool scanlineStatic = false;   // output should latch the static image
+
+// Fraction of every slot (out of MAX_BRIGHTNESS) the column is actually lit
+static int brightness = MAX_BRIGHTNESS;
 struct task_struct *scanlineThread = NULL; // The thread for the scanlines
 struct task_struct *frameThread = NULL;    // The thread for the frames
 
-static unsigned long scanlineNanosec =
-    2000000;  // will scan the entire screen at 100 hz
+// Shared worker used for both scanlines and frames in SCAN_MODE_WORKER
+static struct kthread_worker *scanWorker = NULL;
+static struct kthread_work scanlineWork;
+static struct kthread_work frameWork;
+static ktime_t scanlineDeadline;  // When the queued scanline should be done
+
+// Expiry of the timer tick the thread or worker is currently handling
+static ktime_t scanlineExpires;
+static ktime_t frameExpires;
+
+// Scan the entire screen at 100 hz, however many lines it has
+#define SCAN_FRAME_NSEC 10000000
+
+static const char *const scanModeNames[] = {
+    [SCAN_MODE_THREAD] = "thread",
+    [SCAN_MODE_IRQ] = "irq",
+    [SCAN_MODE_WORKER] = "worker",
+};
+static enum scan_mode scanMode = SCAN_MODE_IRQ;
+
+static char *scan_mode = "irq";
+module_param(scan_mode, charp, 0444);
+MODULE_PARM_DESC(scan_mode,
+                 "How scanlines are driven: thread (wake a kthread every tick), "
+                 "irq (inside the hrtimer callback) or worker (shared "
+                 "kthread_worker). Default irq.");
+
+static const char *const adaptiveScanNames[] = {
+    [ADAPTIVE_SCAN_OFF] = "off",
+    [ADAPTIVE_SCAN_REFRESH] = "refresh",
+    [ADAPTIVE_SCAN_DWELL] = "dwell",
+};
+static enum adaptive_scan adaptiveScan = ADAPTIVE_SCAN_DWELL;
+
+static char *adaptive_scan = "dwell";
+module_param(adaptive_scan, charp, 0444);
+MODULE_PARM_DESC(adaptive_scan,
+                 "Blank column skipping: off (scan all 5 columns), refresh "
+                 "(skip blank columns, keep the slot length) or dwell (skip "
+                 "blank columns, lit ones share the whole frame). Default "
+                 "dwell.");
+
+static const char *const schedPolicyNames[] = {
+    [SCAN_SCHED_OTHER] = "other",
+    [SCAN_SCHED_FIFO] = "fifo",
+    [SCAN_SCHED_DEADLINE] = "deadline",
+};
+// What every scan thread runs with. Only changed once all of them have taken
+// the new setting, under schedLock.
+static enum scan_sched schedPolicy = SCAN_SCHED_OTHER;
+static int schedPriority = DEFAULT_SCHED_PRIORITY;
+static int scanCpu = -1;
+static DEFINE_MUTEX(schedLock);
+
+static char *sched_policy = "other";
+module_param(sched_policy, charp, 0444);
+MODULE_PARM_DESC(sched_policy,
+                 "Scheduling policy of the scan threads/worker: other "
+                 "(default), fifo or deadline");
+module_param_named(sched_priority, schedPriority, int, 0444);
+MODULE_PARM_DESC(sched_priority, "SCHED_FIFO priority, 1-99 (default 50)");
+module_param_named(scan_cpu, scanCpu, int, 0444);
+MODULE_PARM_DESC(scan_cpu,
+                 "CPU to run the scan path on, -1 for any (default)");
+
+// Scan path accounting, reported through timer_get_scan_stats()
+static unsigned long scanlineTicks = 0;    // scanline timer expiries
+static unsigned long scanlineWakeups = 0;  // thread/worker wakeups requested
+static unsigned long scanlineMissed = 0;   // worker finished after deadline
+static unsigned long scanlineFlips = 0;    // new images shown
+static unsigned long scanlineDeferredFlips = 0;  // held back to cycle end
+static bool flipDeferred = false;  // an image arrived during this cycle
+
+// The number of scan slots in one frame, blank columns are left out unless
+// adaptive scanning is off
+static int scan_slot_count(void) {
+  if (adaptiveScan == ADAPTIVE_SCAN_OFF) return matrix_get_scan_positions();
+  return matrix_get_scan_slots();
+}
+
+// One scanline when every one of `positions` scan positions is shown
+static ktime_t scanline_interval(int positions) {
+  return ns_to_ktime(div_u64(ktime_to_ns(scanFrameInterval), positions));
+}
+
+// How long to hold each slot when there are `slots` of them out of
+// `positions`. In dwell mode the whole frame is shared between the lit
+// positions, otherwise each gets one scanline. A blank image is held for one
+// frame per tick in every adaptive mode.
+static ktime_t scanline_dwell(int slots, int positions) {
+  if (!slots) return scanFrameInterval;
+  if (adaptiveScan != ADAPTIVE_SCAN_DWELL) return scanline_interval(positions);
+  return ns_to_ktime(div_u64(ktime_to_ns(scanFrameInterval), slots));
+}
+
+// Whether the last plane of the last slot has been shown (or nothing has)
+static bool scanline_cycle_done(void) {
+  return currentCol == 0 ||
+         (currentCol >= scan_slot_count() &&
+          currentPlane + 1 >= matrix_get_scan_planes());
+}
+
+// Move to the next bit plane, or the first plane of the next lit column, and
+// return how long to show it. Runs in the timer callback in every scan mode
+// so the timer can be forwarded by the right amount.
+static ktime_t scanline_advance(void) {
+  int slots, planes;
+  int level = READ_ONCE(brightness);
+  u64 dwellNanosec, onNanosec;
+
+  // Second edge within the slot: blank until the slot is over, so dimming
+  // never stretches the frame
+  if (!blankPhase && blankInterval) {
+    blankPhase = true;
+    return blankInterval;
+  }
+  blankPhase = false;
+  blankInterval = 0;
+
+  // A new image is only flipped in once the whole previous one has been
+  // drawn, so no refresh ever shows parts of two images
+  if (scanline_cycle_done()) {
+    if (matrix_flip()) {
+      scanlineFlips++;
+      if (flipDeferred) scanlineDeferredFlips++;
+    }
+    flipDeferred = false;
+    if (currentCol) device_notify(LEDMATRIX_EVENT_CYCLE);
+    currentCol = 0;
+  } else if (matrix_flip_pending()) {
+    flipDeferred = true;
+  }
+
+  slots = scan_slot_count();
+  planes = matrix_get_scan_planes();
+  dwellNanosec =
+      ktime_to_ns(scanline_dwell(slots, matrix_get_scan_positions()));
+  if (!slots || !level) {
+    currentCol = 0;
+    currentPlane = 0;
+    return ns_to_ktime(dwellNanosec);
+  }
+
+  if (currentCol == 0) {
+    currentCol = 1;
+    currentPlane = 0;
+  } else if (++currentPlane >= planes) {
+    currentPlane = 0;
+    currentCol++;
+  }
+  // binary code modulation: plane p is shown for 2^p of the column's
+  // (2^planes - 1) parts
+  dwellNanosec = div_u64(dwellNanosec << currentPlane, (1 << planes) - 1);
+  if (level == MAX_BRIGHTNESS) return ns_to_ktime(dwellNanosec);
+
+  onNanosec = div_u64(dwellNanosec * level, MAX_BRIGHTNESS);
+  blankInterval = ns_to_ktime(dwellNanosec - onNanosec);
+  return ns_to_ktime(onNanosec);
+}
+
+// Restart the scanline timer. In irq mode the timer is pinned, so it is
+// started from the chosen cpu.
+static void scanline_timer_start_local(void *interval) {
+  hrtimer_start(&scanlineTimer, *(ktime_t *)interval, scanlineTimerMode);
+}
+
+static void scanline_timer_start(ktime_t interval) {
+  int cpu = READ_ONCE(scanCpu);
+  if (scanMode == SCAN_MODE_IRQ && cpu >= 0 && cpu_online(cpu)) {
+    smp_call_function_single(cpu, scanline_timer_start_local, &interval, 1);
+  } else {
+    scanline_timer_start_local(&interval);
+  }
+}
+
+// Stop scanning when the image can be driven statically. scanlineStopped is
+// published before checking again, so a concurrent matrix_compile either sees
+// it and kicks the timer or is seen here.
+static bool scanline_try_stop(void) {
+  if (!matrix_is_static() || READ_ONCE(brightness) != MAX_BRIGHTNESS) {
+    return false;
+  }
+  WRITE_ONCE(scanlineStopped, true);
+  smp_mb();
+  if (matrix_is_static() && !matrix_flip_pending() &&
+      READ_ONCE(brightness) == MAX_BRIGHTNESS) {
+    // the latched image counts as a complete cycle
+    currentCol = 0;
+    currentPlane = 0;
+    return true;
+  }
+  WRITE_ONCE(scanlineStopped, false);
+  return false;
+}
+
+// Display the column and bit plane picked by scanline_advance
+static void scanline_output(void) {
+  int col = READ_ONCE(currentCol);
+  int plane = READ_ONCE(currentPlane);
+  if (READ_ONCE(scanlineStatic)) {
+    matrix_display_static();
+  } else if (col == 0 || READ_ONCE(blankPhase)) {
+    matrix_display_clear();
+  } else if (adaptiveScan == ADAPTIVE_SCAN_OFF) {
+    matrix_display_col(col - 1, plane);
+  } else {
+    matrix_display_slot(col - 1, plane);
+  }
+}
 
 // The timer callback functions
 static enum hrtimer_restart restartScanlineTimer(struct hrtimer *timer) {
-  wake_up_process(scanlineThread);
-  hrtimer_forward_now(timer, scanlineTimerInterval);
+  bool stop = scanline_try_stop();
+  ktime_t dwell = stop ? KTIME_MAX : scanline_advance();
+  WRITE_ONCE(scanlineStatic, stop);
+  scanlineTicks++;
+  scanlineExpires = hrtimer_get_expires(timer);
+  switch (scanMode) {
+    case SCAN_MODE_IRQ:
+      // Atomic context, the gpio pins have been checked not to sleep
+      scanline_output();
+      latency_record(LATENCY_SCANLINE, scanlineExpires);
+      break;
+    case SCAN_MODE_WORKER:
+      scanlineDeadline =
+          stop ? KTIME_MAX : ktime_add(hrtimer_get_expires(timer), dwell);
+      // Only counts as a wakeup when the previous column has been handled
+      if (kthread_queue_work(scanWorker, &scanlineWork)) scanlineWakeups++;
+      break;
+    case SCAN_MODE_THREAD:
+      wake_up_process(scanlineThread);
+      scanlineWakeups++;
+      break;
+  }
+  // the pins are latched, timer_kick_scanline restarts the timer
+  if (stop) return HRTIMER_NORESTART;
+  hrtimer_forward_now(timer, dwell);
   return HRTIMER_RESTART;
 }
 
 static enum hrtimer_restart restartFrameTimer(struct hrtimer *timer) {
-  wake_up_process(frameThread);
-  hrtimer_forward_now(timer, frameTimerInterval);
+  // an animation moves to its next frame here, so its timing does not depend
+  // on when the frame thread gets to run
+  u64 animationNsec = matrix_animation_step();
+  frameExpires = hrtimer_get_expires(timer);
+  if (scanMode == SCAN_MODE_WORKER) {
+    kthread_queue_work(scanWorker, &frameWork);
+  } else {
+    wake_up_process(frameThread);
+  }
+  hrtimer_forward_now(timer, animationNsec ? ns_to_ktime(animationNsec)
+                                           : frameTimerInterval);
   return HRTIMER_RESTART;
 }
 
 // Cycle through the scanlines
 static int updateScanLine(void *data) {
   while (1) {
-    currentCol++;
-    if (currentCol <= COLS) {
-      matrix_display_col(currentCol - 1);
-    } else {
-      matrix_display_col(0);
-      currentCol = 1;
-    }
+    scanline_output();
+    if (scanlineExpires) latency_record(LATENCY_SCANLINE, scanlineExpires);
 
     set_current_state(TASK_INTERRUPTIBLE);
     schedule();  // Yield to other processes until timer expires again
@@ -52,36 +308,135 @@ static int updateScanLine(void *data) {
 // Cycle through the frames (scrolling)
 static int updateFrame(void *data) {
   while (1) {
-    matrix_display_scroll();
+    if (matrix_display_scroll()) device_notify(LEDMATRIX_EVENT_SCROLL);
+    if (frameExpires) latency_record(LATENCY_FRAME, frameExpires);
     set_current_state(TASK_INTERRUPTIBLE);
     schedule();  // Yield to other processes until timer expires again
     if (kthread_should_stop()) {
       break;
     }
   }
-  
+
   printk(KERN_INFO "updateFrame terminating.\n");
   return 0;
 }
 
-int timer_init(void) {
-  printk(KERN_INFO "Repeating Timer module is loaded\n");
+// Work items for the shared worker
+static void scanlineWorkFn(struct kthread_work *work) {
+  scanline_output();
+  latency_record(LATENCY_SCANLINE, scanlineExpires);
+  // The next column should already be showing, this one ran too late
+  if (ktime_after(ktime_get(), scanlineDeadline)) scanlineMissed++;
+}
+
+static void frameWorkFn(struct kthread_work *work) {
+  if (matrix_display_scroll()) device_notify(LEDMATRIX_EVENT_SCROLL);
+  latency_record(LATENCY_FRAME, frameExpires);
+}
+
+// Parse the scan_mode parameter, falling back from irq when the pins can sleep
+static int select_scan_mode(void) {
+  int mode = sysfs_match_string(scanModeNames, scan_mode);
+  if (mode < 0) {
+    printk(KERN_ALERT "Unknown scan_mode %s\n", scan_mode);
+    return -EINVAL;
+  }
+  scanMode = mode;
+
+  mode = sysfs_match_string(schedPolicyNames, sched_policy);
+  if (mode < 0) {
+    printk(KERN_ALERT "Unknown sched_policy %s\n", sched_policy);
+    return -EINVAL;
+  }
+  schedPolicy = mode;
+
+  mode = sysfs_match_string(adaptiveScanNames, adaptive_scan);
+  if (mode < 0) {
+    printk(KERN_ALERT "Unknown adaptive_scan %s\n", adaptive_scan);
+    return -EINVAL;
+  }
+  adaptiveScan = mode;
+
+  // the worker writes such pins with the _cansleep accessors, which the
+  // hrtimer callback cannot use
+  if (scanMode == SCAN_MODE_IRQ && matrix_gpio_can_sleep()) {
+    printk(KERN_INFO "GPIO pins may sleep, scanning from worker instead\n");
+    scanMode = SCAN_MODE_WORKER;
+  }
+  printk(KERN_INFO "Scan mode: %s\n", scanModeNames[scanMode]);
+  return 0;
+}
+
+static int start_scan_threads(void) {
+  if (scanMode == SCAN_MODE_WORKER) {
+    scanWorker = kthread_create_worker(0, "ledMatrixScan");
+    if (IS_ERR(scanWorker)) {
+      int ret = PTR_ERR(scanWorker);
+      scanWorker = NULL;
+      return ret;
+    }
+    kthread_init_work(&scanlineWork, scanlineWorkFn);
+    kthread_init_work(&frameWork, frameWorkFn);
+    return 0;
+  }
 
   // Begin the threads and associate the relavent restart functions
-  scanlineThread = kthread_run(updateScanLine, NULL, "updateScanLine");
+  if (scanMode == SCAN_MODE_THREAD) {
+    scanlineThread = kthread_run(updateScanLine, NULL, "updateScanLine");
+    if (IS_ERR(scanlineThread)) {
+      int ret = PTR_ERR(scanlineThread);
+      scanlineThread = NULL;
+      return ret;
+    }
+  }
   frameThread = kthread_run(updateFrame, NULL, "updateFrame");
-  if ((void *)scanlineThread == ERR_PTR || (void *)frameThread == ERR_PTR) {
+  if (IS_ERR(frameThread)) {
+    int ret = PTR_ERR(frameThread);
+    frameThread = NULL;
+    if (scanlineThread) kthread_stop(scanlineThread);
+    scanlineThread = NULL;
+    return ret;
+  }
+  return 0;
+}
+
+int timer_init(void) {
+  enum scan_sched policy;
+  int priority, cpu;
+  int ret;
+  printk(KERN_INFO "Repeating Timer module is loaded\n");
+
+  ret = select_scan_mode();
+  if (ret) return ret;
+  // the parameters are applied once the threads exist, until then the scan
+  // path runs with the defaults
+  policy = schedPolicy;
+  priority = schedPriority;
+  cpu = scanCpu;
+  schedPolicy = SCAN_SCHED_OTHER;
+  schedPriority = DEFAULT_SCHED_PRIORITY;
+  scanCpu = -1;
+
+  ret = start_scan_threads();
+  if (ret) {
     printk(KERN_ALERT "Thread failed to create!\n");
-    return EINTR;
+    return ret;
   }
 
   // Initialize the timers
-  scanlineTimerInterval = ktime_set(0, scanlineNanosec);
-  printk(KERN_INFO "Timer initial timer value is %lldms \n",
-         ktime_to_ms(scanlineTimerInterval));
-  hrtimer_init(&scanlineTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  // In irq mode the callback does the gpio work, so keep it in hard irq
+  // context even on PREEMPT_RT kernels, and on the cpu it was started from
+  if (scanMode == SCAN_MODE_IRQ) {
+    scanlineTimerMode = HRTIMER_MODE_REL_PINNED_HARD;
+  }
+  // a larger display gets shorter scanlines, not a slower refresh
+  scanFrameInterval = ktime_set(0, SCAN_FRAME_NSEC);
+  matrix_set_scan_all(adaptiveScan == ADAPTIVE_SCAN_OFF);
+  printk(KERN_INFO "Timer initial timer value is %lldus \n",
+         ktime_to_us(scanline_interval(matrix_get_scan_positions())));
+  hrtimer_init(&scanlineTimer, CLOCK_MONOTONIC, scanlineTimerMode);
   scanlineTimer.function = restartScanlineTimer;
-  hrtimer_start(&scanlineTimer, scanlineTimerInterval, HRTIMER_MODE_REL);
+  scanline_timer_start(scanline_interval(matrix_get_scan_positions()));
 
   frameTimerInterval = ktime_set(__INT_MAX__, __INT_MAX__);  // start at 0 fps
   printk(KERN_INFO "Timer initial timer value is %lldms \n",
@@ -89,27 +444,271 @@ int timer_init(void) {
   hrtimer_init(&frameTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
   frameTimer.function = restartFrameTimer;
   hrtimer_start(&frameTimer, frameTimerInterval, HRTIMER_MODE_REL);
+
+  // A bad policy or cpu is reported but the display still works without it,
+  // and the attributes show what is actually in use
+  if (cpu >= 0) timer_set_scan_cpu(cpu);
+  timer_set_sched(policy, priority);
   return 0;
 }
 
 void timer_exit(void) {
   printk(KERN_INFO "Unloading module and attempting to cancel timer\n");
-  kthread_stop(scanlineThread);
-  kthread_stop(frameThread);
+  // Stop the timers first so nothing wakes a thread that is going away
   hrtimer_cancel(&scanlineTimer);
   hrtimer_cancel(&frameTimer);
+  if (scanWorker) {
+    kthread_destroy_worker(scanWorker);  // flushes any queued work
+    scanWorker = NULL;
+  }
+  if (scanlineThread) kthread_stop(scanlineThread);
+  if (frameThread) kthread_stop(frameThread);
+  scanlineThread = NULL;
+  frameThread = NULL;
 }
 
+static void scan_refresh_deadline(void);
+
 void timer_set_scanline_interval(int sec, unsigned long nsec) {
-  scanlineTimerInterval = ktime_set(sec, nsec);
+  ktime_t interval = ktime_set(sec, nsec);
+  // kept as the frame it adds up to when every position is scanned
+  scanFrameInterval = interval * matrix_get_scan_positions();
+  WRITE_ONCE(scanlineStopped, false);
   printk(KERN_INFO "Scanline interval set to %lldms \n",
-         ktime_to_ms(scanlineTimerInterval));
-  hrtimer_start(&scanlineTimer, scanlineTimerInterval, HRTIMER_MODE_REL);
+         ktime_to_ms(interval));
+  scanline_timer_start(interval);
+  scan_refresh_deadline();
 }
 
 void timer_set_frame_interval(int sec, unsigned long nsec) {
-  frameTimerInterval = ktime_set(sec, nsec);
+  timer_restore_frame_interval(ktime_set(sec, nsec));
+}
+
+ktime_t timer_get_frame_interval(void) { return frameTimerInterval; }
+
+void timer_restore_frame_interval(ktime_t interval) {
+  frameTimerInterval = interval;
   printk(KERN_INFO "Frame interval set to %lldms \n",
          ktime_to_ms(frameTimerInterval));
   hrtimer_start(&frameTimer, frameTimerInterval, HRTIMER_MODE_REL);
-}
\ No newline at end of file
+}
+
+void timer_start_animation(u64 nsec) {
+  hrtimer_start(&frameTimer, ns_to_ktime(nsec), HRTIMER_MODE_REL);
+}
+
+const char *timer_get_scan_mode(void) { return scanModeNames[scanMode]; }
+
+void timer_get_scan_stats(struct scan_stats *stats) {
+  stats->ticks = READ_ONCE(scanlineTicks);
+  stats->wakeups = READ_ONCE(scanlineWakeups);
+  stats->missed = READ_ONCE(scanlineMissed);
+  stats->flips = READ_ONCE(scanlineFlips);
+  stats->deferredFlips = READ_ONCE(scanlineDeferredFlips);
+}
+
+void timer_get_refresh(unsigned long *millihertz, int *slots,
+                       unsigned long *wakeups, bool *latched) {
+  int level = READ_ONCE(brightness);
+  int count = level ? scan_slot_count() : 0;
+  int planes = count ? matrix_get_scan_planes() : 1;
+  u64 dwellNanosec =
+      ktime_to_ns(scanline_dwell(count, matrix_get_scan_positions()));
+  *slots = count;
+  *latched = READ_ONCE(scanlineStopped);
+  if (*latched) {
+    // nothing to refresh, the pins hold the image
+    *millihertz = 0;
+    *wakeups = 0;
+    return;
+  }
+  // every bit plane of a slot is its own timer event, dimming adds a second
+  if (count && level != MAX_BRIGHTNESS) planes *= 2;
+  *wakeups = div64_u64(NSEC_PER_SEC * planes, dwellNanosec);
+  // a full refresh takes one dwell per slot, nothing refreshes when blank
+  *millihertz = count ? div64_u64(NSEC_PER_SEC * 1000ULL, dwellNanosec * count)
+                      : 0;
+}
+
+void timer_get_axis_refresh(enum scan_axis axis, unsigned long *millihertz,
+                            unsigned long *dutyPermille) {
+  struct scan_axis_info info;
+  int level = READ_ONCE(brightness);
+  int count;
+  u64 dwellNanosec;
+
+  matrix_get_scan_axis_info(axis, &info);
+  count = adaptiveScan == ADAPTIVE_SCAN_OFF ? info.positions : info.slots;
+  if (!level || !info.slots) {
+    *millihertz = 0;
+    *dutyPermille = 0;
+    return;
+  }
+  dwellNanosec = ktime_to_ns(scanline_dwell(count, info.positions));
+  *millihertz = div64_u64(NSEC_PER_SEC * 1000ULL, dwellNanosec * count);
+  // every LED gets one of the count slots, dimmed by the brightness
+  *dutyPermille = 1000UL * level / MAX_BRIGHTNESS / count;
+}
+
+int timer_get_brightness(void) { return READ_ONCE(brightness); }
+
+void timer_set_brightness(int level) {
+  WRITE_ONCE(brightness, clamp(level, 0, MAX_BRIGHTNESS));
+  // dimming needs scanning even for a static image
+  smp_mb();
+  timer_kick_scanline();
+}
+
+void timer_kick_scanline(void) {
+  if (!READ_ONCE(scanlineStopped)) return;
+  WRITE_ONCE(scanlineStopped, false);
+  scanline_timer_start(0);
+}
+
+// Apply a scheduling policy to one thread. SCHED_DEADLINE gets the shortest
+// scanline the display can have as period and deadline, with a tenth of it as
+// runtime. That is the frame shared by the most scan positions either axis
+// has, so it stays valid when the axis changes with the image; it only moves
+// with the scanline interval itself.
+static int scan_apply_sched(struct task_struct *task, bool scanline,
+                            enum scan_sched policy, int priority) {
+  struct sched_attr attr = {.size = sizeof(attr)};
+  if (!task) return 0;
+
+  switch (policy) {
+    case SCAN_SCHED_OTHER:
+      attr.sched_policy = SCHED_NORMAL;
+      break;
+    case SCAN_SCHED_DEADLINE:
+      if (scanline) {
+        attr.sched_policy = SCHED_DEADLINE;
+        attr.sched_period = ktime_to_ns(
+            scanline_interval(matrix_get_max_scan_positions()));
+        attr.sched_deadline = attr.sched_period;
+        attr.sched_runtime = div_u64(attr.sched_period, 10);
+        break;
+      }
+      // the frame thread has no fixed period, it runs as fifo instead
+      fallthrough;
+    case SCAN_SCHED_FIFO:
+      attr.sched_policy = SCHED_FIFO;
+      attr.sched_priority = priority;
+      break;
+  }
+  return sched_setattr_nocheck(task, &attr);
+}
+
+// The scan threads in the order settings are applied, NULL when not in use
+static void scan_tasks(struct task_struct *tasks[3], bool scanline[3]) {
+  tasks[0] = scanlineThread;
+  scanline[0] = true;
+  tasks[1] = frameThread;
+  scanline[1] = false;
+  tasks[2] = scanWorker ? scanWorker->task : NULL;
+  scanline[2] = true;
+}
+
+// Give the deadline threads a period for the current scanline interval
+static void scan_refresh_deadline(void) {
+  struct task_struct *tasks[3];
+  bool scanline[3];
+  int ret;
+  mutex_lock(&schedLock);
+  if (schedPolicy == SCAN_SCHED_DEADLINE) {
+    scan_tasks(tasks, scanline);
+    for (int i = 0; i < ARRAY_SIZE(tasks); i++) {
+      if (!scanline[i]) continue;
+      ret = scan_apply_sched(tasks[i], true, schedPolicy, schedPriority);
+      if (ret) {
+        printk(KERN_ALERT "Failed to update deadline scheduling: %d\n", ret);
+      }
+    }
+  }
+  mutex_unlock(&schedLock);
+}
+
+int timer_set_sched(enum scan_sched policy, int priority) {
+  struct task_struct *tasks[3];
+  bool scanline[3];
+  int ret = 0;
+  int done;
+  if (priority < 1 || priority >= MAX_RT_PRIO) return -EINVAL;
+
+  mutex_lock(&schedLock);
+  scan_tasks(tasks, scanline);
+  for (done = 0; done < ARRAY_SIZE(tasks); done++) {
+    ret = scan_apply_sched(tasks[done], scanline[done], policy, priority);
+    if (ret) break;
+  }
+  if (ret) {
+    printk(KERN_ALERT "Failed to set %s scheduling: %d\n",
+           schedPolicyNames[policy], ret);
+    // put the threads that did change back, so they all run the same way
+    while (done--) {
+      scan_apply_sched(tasks[done], scanline[done], schedPolicy,
+                       schedPriority);
+    }
+  } else {
+    schedPolicy = policy;
+    schedPriority = priority;
+  }
+  mutex_unlock(&schedLock);
+  return ret;
+}
+
+const char *timer_get_sched(int *priority) {
+  const char *name;
+  mutex_lock(&schedLock);
+  *priority = schedPriority;
+  name = schedPolicyNames[schedPolicy];
+  mutex_unlock(&schedLock);
+  return name;
+}
+
+int timer_parse_sched_policy(const char *name) {
+  return sysfs_match_string(schedPolicyNames, name);
+}
+
+// The cpus the scan path may run on for a scan_cpu value
+static const struct cpumask *scan_cpu_mask(int cpu) {
+  return cpu >= 0 ? cpumask_of(cpu) : cpu_possible_mask;
+}
+
+int timer_set_scan_cpu(int cpu) {
+  struct task_struct *tasks[3];
+  bool scanline[3];
+  int ret = 0;
+  int done;
+  if (cpu >= 0 && (cpu >= nr_cpu_ids || !cpu_online(cpu))) {
+    printk(KERN_ALERT "Cannot move the scan path to cpu %d\n", cpu);
+    return -EINVAL;
+  }
+
+  mutex_lock(&schedLock);
+  scan_tasks(tasks, scanline);
+  for (done = 0; done < ARRAY_SIZE(tasks); done++) {
+    if (!tasks[done]) continue;
+    ret = set_cpus_allowed_ptr(tasks[done], scan_cpu_mask(cpu));
+    if (ret) break;
+  }
+  if (ret) {
+    printk(KERN_ALERT "Failed to move the scan path to cpu %d: %d\n", cpu,
+           ret);
+    while (done--) {
+      if (tasks[done]) {
+        set_cpus_allowed_ptr(tasks[done], scan_cpu_mask(scanCpu));
+      }
+    }
+    mutex_unlock(&schedLock);
+    return ret;
+  }
+  WRITE_ONCE(scanCpu, cpu);
+  mutex_unlock(&schedLock);
+  // move the pinned irq mode timer over as well
+  if (scanMode == SCAN_MODE_IRQ && !READ_ONCE(scanlineStopped)) {
+    scanline_timer_start(scanline_interval(matrix_get_scan_positions()));
+  }
+  return 0;
+}
+
+int timer_get_scan_cpu(void) { return READ_ONCE(scanCpu); }
@@ -1,4 +1,39 @@
+#include <linux/ktime.h>
+
+#include "matrix.h"
+
 #define DEFAULT_SCROLL_FPS 5
+#define DEFAULT_SCHED_PRIORITY 50
+#define MAX_BRIGHTNESS 255
+
+// Where the scanline work runs, selected with the scan_mode module parameter
+enum scan_mode {
+  SCAN_MODE_THREAD,  // timer wakes a dedicated kthread for every scanline
+  SCAN_MODE_IRQ,     // scanline is written from the hrtimer callback itself
+  SCAN_MODE_WORKER,  // one shared kthread_worker for scanlines and frames
+};
+
+// How blank columns are handled, selected with the adaptive_scan parameter
+enum adaptive_scan {
+  ADAPTIVE_SCAN_OFF,      // every column gets a slot, lit or not
+  ADAPTIVE_SCAN_REFRESH,  // blank columns skipped, refresh rate goes up
+  ADAPTIVE_SCAN_DWELL,    // blank columns skipped, lit ones are held longer
+};
+
+// Scheduling policy of the scan threads, selected with sched_policy
+enum scan_sched {
+  SCAN_SCHED_OTHER,     // default SCHED_NORMAL
+  SCAN_SCHED_FIFO,      // SCHED_FIFO at sched_priority
+  SCAN_SCHED_DEADLINE,  // SCHED_DEADLINE with the scanline as period
+};
+
+struct scan_stats {
+  unsigned long ticks;    // scanline timer expiries
+  unsigned long wakeups;  // thread/worker wakeups
+  unsigned long missed;   // scanlines the worker finished too late
+  unsigned long flips;    // new images flipped in, always at a cycle end
+  unsigned long deferredFlips;  // of those, images that arrived mid cycle
+};
 
 // Initialize two timers, one for the scanlines and one to update the framebuffer.
 int timer_init(void);
@@ -7,4 +42,38 @@ void timer_exit(void);
 // Set the time to display each scanline.
 void timer_set_scanline_interval(int sec, unsigned long nsec);
 // Set the delay between frames.
-void timer_set_frame_interval(int sec, unsigned long nsec);
\ No newline at end of file
+void timer_set_frame_interval(int sec, unsigned long nsec);
+// The delay between frames, to put back later with
+// timer_restore_frame_interval.
+ktime_t timer_get_frame_interval(void);
+void timer_restore_frame_interval(ktime_t interval);
+// Restart the frame timer to expire after the first frame of a new animation,
+// later frames are timed by matrix_animation_step.
+void timer_start_animation(u64 nsec);
+// Name of the scan mode in use.
+const char *timer_get_scan_mode(void);
+// Scan path counters since loading.
+void timer_get_scan_stats(struct scan_stats *stats);
+// Effective full refresh rate, scan slots per refresh and timer wakeups per
+// second for the current image, and whether it is latched without scanning.
+void timer_get_refresh(unsigned long *millihertz, int *slots,
+                       unsigned long *wakeups, bool *latched);
+// Refresh rate and the share of time (in tenths of a percent) each lit LED is
+// on if the current image were scanned along `axis`.
+void timer_get_axis_refresh(enum scan_axis axis, unsigned long *millihertz,
+                            unsigned long *dutyPermille);
+// Restart scanning if it was stopped on a static image. Call after the image
+// changes.
+void timer_kick_scanline(void);
+// Fraction of each scan slot, out of MAX_BRIGHTNESS, the display is lit.
+int timer_get_brightness(void);
+void timer_set_brightness(int level);
+// Set the scheduling policy and fifo priority of the scan threads/worker.
+int timer_set_sched(enum scan_sched policy, int priority);
+// Name of the scheduling policy in use, and its fifo priority.
+const char *timer_get_sched(int *priority);
+// Look up a scheduling policy by name, negative when unknown.
+int timer_parse_sched_policy(const char *name);
+// Pin the scan path (threads, worker or irq mode timer) to a cpu, -1 for any.
+int timer_set_scan_cpu(int cpu);
+int timer_get_scan_cpu(void);
\ No newline at end of file